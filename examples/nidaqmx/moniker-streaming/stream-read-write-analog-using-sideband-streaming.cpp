@@ -31,6 +31,9 @@
 * Server machine's IP address, port number, and physical channel name can be passed as separate
 * command line arguments.
 *   > MonikerStreamingClient <server_address> <port_number> <physical_channel_name>
+* Pass a sample rate after the number of channels to run a hardware timed single point control loop
+* instead, optionally followed by the number of iterations.
+*   > MonikerStreamingClient <server_address> <port_number> <read_device> <write_device> <num_channels> <hwtsp_rate> <iterations>
 * If they are not passed in as command line arguments, then by default the server address will be
 * "localhost:31763", with "Dev1/ai0" as the physical channel name..
 *********************************************************************/
@@ -39,6 +42,7 @@
 #include <sstream>
 #include <grpcpp/grpcpp.h>
 #include <sideband_grpc.h>
+#include <sideband_control_loop.h>
 
 
 #include "nidaqmx.grpc.pb.h"
@@ -56,6 +60,9 @@ std::string READ_DEVICE = "Dev1";
 std::string WRITE_DEVICE = "Dev1";
 int NUM_CHANNELS = 1;
 int NUM_ITERATIONS = 5;
+// Sample clock rate of the hardware timed single point loop, 0 runs the
+// loop software timed.
+double HWTSP_RATE = 0.0;
 
 class grpc_driver_error : public std::runtime_error {
  private:
@@ -126,27 +133,39 @@ void print_array(const MonikerReadAnalogF64Response& data)
     client.CreateAIVoltageChan(&create_channel_context, create_channel_request, &create_channel_response),
     create_channel_context);
 
-  // ::grpc::ClientContext cfg_clk_context;
-  // auto cfg_clk_request = CfgSampClkTimingRequest{};
-  // cfg_clk_request.mutable_task()->CopyFrom(daqmx_read_task);
-  // cfg_clk_request.set_rate(100.0);
-  // cfg_clk_request.set_active_edge(Edge1::EDGE1_RISING);
-  // cfg_clk_request.set_sample_mode(AcquisitionType::ACQUISITION_TYPE_HW_TIMED_SINGLE_POINT);
-  // cfg_clk_request.set_samps_per_chan(10);
-  // auto cfg_clk_response = CfgSampClkTimingResponse{};
-  // raise_if_error(
-  //   client.CfgSampClkTiming(&cfg_clk_context, cfg_clk_request, &cfg_clk_response),
-  //   cfg_clk_context);
-
-  // ::grpc::ClientContext set_read_attribute_context;
-  // auto set_read_attribute_request = SetReadAttributeInt32Request{};
-  // set_read_attribute_request.mutable_task()->CopyFrom(daqmx_read_task);
-  // set_read_attribute_request.set_attribute(ReadInt32Attribute::READ_ATTRIBUTE_WAIT_MODE);
-  // set_read_attribute_request.set_value(ReadInt32AttributeValues::READ_INT32_WAIT_MODE_POLL);
-  // auto set_read_attribute_response = SetReadAttributeInt32Response{};
-  // raise_if_error(
-  //   client.SetReadAttributeInt32(&set_read_attribute_context, set_read_attribute_request, &set_read_attribute_response),
-  //   set_read_attribute_context);
+  if (HWTSP_RATE > 0) {
+    ::grpc::ClientContext cfg_clk_context;
+    auto cfg_clk_request = CfgSampClkTimingRequest{};
+    cfg_clk_request.mutable_task()->CopyFrom(daqmx_read_task);
+    cfg_clk_request.set_rate(HWTSP_RATE);
+    cfg_clk_request.set_active_edge(Edge1::EDGE1_RISING);
+    cfg_clk_request.set_sample_mode(AcquisitionType::ACQUISITION_TYPE_HW_TIMED_SINGLE_POINT);
+    cfg_clk_request.set_samps_per_chan(1);
+    auto cfg_clk_response = CfgSampClkTimingResponse{};
+    raise_if_error(
+      client.CfgSampClkTiming(&cfg_clk_context, cfg_clk_request, &cfg_clk_response),
+      cfg_clk_context);
+
+    ::grpc::ClientContext set_read_attribute_context;
+    auto set_read_attribute_request = SetReadAttributeInt32Request{};
+    set_read_attribute_request.mutable_task()->CopyFrom(daqmx_read_task);
+    set_read_attribute_request.set_attribute(ReadInt32Attribute::READ_ATTRIBUTE_WAIT_MODE);
+    set_read_attribute_request.set_value(ReadInt32AttributeValues::READ_INT32_WAIT_MODE_POLL);
+    auto set_read_attribute_response = SetReadAttributeInt32Response{};
+    raise_if_error(
+      client.SetReadAttributeInt32(&set_read_attribute_context, set_read_attribute_request, &set_read_attribute_response),
+      set_read_attribute_context);
+
+    ::grpc::ClientContext set_realtime_attribute_context;
+    auto set_realtime_attribute_request = SetRealTimeAttributeInt32Request{};
+    set_realtime_attribute_request.mutable_task()->CopyFrom(daqmx_read_task);
+    set_realtime_attribute_request.set_attribute(RealTimeInt32Attribute::REALTIME_ATTRIBUTE_WAIT_FOR_NEXT_SAMP_CLK_WAIT_MODE);
+    set_realtime_attribute_request.set_value(RealTimeInt32AttributeValues::REALTIME_INT32_WAIT_MODE3_POLL);
+    auto set_realtime_attribute_response = SetRealTimeAttributeInt32Response{};
+    raise_if_error(
+      client.SetRealTimeAttributeInt32(&set_realtime_attribute_context, set_realtime_attribute_request, &set_realtime_attribute_response),
+      set_realtime_attribute_context);
+  }
 
   ::grpc::ClientContext start_task_context;
   StartTaskRequest start_task_request;
@@ -181,27 +200,29 @@ void print_array(const MonikerReadAnalogF64Response& data)
         client.CreateAOVoltageChan(&create_channel_context, create_channel_request, &create_channel_response),
         create_channel_context);
 
-    // ::grpc::ClientContext cfg_clk_context;
-    // auto cfg_clk_request = CfgSampClkTimingRequest{};
-    // cfg_clk_request.mutable_task()->CopyFrom(daqmx_write_task);
-    // cfg_clk_request.set_rate(100.0);
-    // cfg_clk_request.set_active_edge(Edge1::EDGE1_RISING);
-    // cfg_clk_request.set_sample_mode(AcquisitionType::ACQUISITION_TYPE_HW_TIMED_SINGLE_POINT);
-    // cfg_clk_request.set_samps_per_chan(10);
-    // auto cfg_clk_response = CfgSampClkTimingResponse{};
-    // raise_if_error(
-    //     client.CfgSampClkTiming(&cfg_clk_context, cfg_clk_request, &cfg_clk_response),
-    //     cfg_clk_context);
-
-    // ::grpc::ClientContext set_write_attribute_context;
-    // auto set_write_attribute_request = SetWriteAttributeInt32Request{};
-    // set_write_attribute_request.mutable_task()->CopyFrom(daqmx_write_task);
-    // set_write_attribute_request.set_attribute(WriteInt32Attribute::WRITE_ATTRIBUTE_WAIT_MODE);
-    // set_write_attribute_request.set_value(WriteInt32AttributeValues::WRITE_INT32_WAIT_MODE_POLL);
-    // auto set_write_attribute_response = SetWriteAttributeInt32Response{};
-    // raise_if_error(
-    //     client.SetWriteAttributeInt32(&set_write_attribute_context, set_write_attribute_request, &set_write_attribute_response),
-    //     set_write_attribute_context);
+    if (HWTSP_RATE > 0) {
+        ::grpc::ClientContext cfg_clk_context;
+        auto cfg_clk_request = CfgSampClkTimingRequest{};
+        cfg_clk_request.mutable_task()->CopyFrom(daqmx_write_task);
+        cfg_clk_request.set_rate(HWTSP_RATE);
+        cfg_clk_request.set_active_edge(Edge1::EDGE1_RISING);
+        cfg_clk_request.set_sample_mode(AcquisitionType::ACQUISITION_TYPE_HW_TIMED_SINGLE_POINT);
+        cfg_clk_request.set_samps_per_chan(1);
+        auto cfg_clk_response = CfgSampClkTimingResponse{};
+        raise_if_error(
+            client.CfgSampClkTiming(&cfg_clk_context, cfg_clk_request, &cfg_clk_response),
+            cfg_clk_context);
+
+        ::grpc::ClientContext set_write_attribute_context;
+        auto set_write_attribute_request = SetWriteAttributeInt32Request{};
+        set_write_attribute_request.mutable_task()->CopyFrom(daqmx_write_task);
+        set_write_attribute_request.set_attribute(WriteInt32Attribute::WRITE_ATTRIBUTE_WAIT_MODE);
+        set_write_attribute_request.set_value(WriteInt32AttributeValues::WRITE_INT32_WAIT_MODE2_POLL);
+        auto set_write_attribute_response = SetWriteAttributeInt32Response{};
+        raise_if_error(
+            client.SetWriteAttributeInt32(&set_write_attribute_context, set_write_attribute_request, &set_write_attribute_response),
+            set_write_attribute_context);
+    }
 
     ::grpc::ClientContext start_task_context;
     StartTaskRequest start_task_request;
@@ -231,6 +252,12 @@ int main(int argc, char **argv)
   if (argc >= 6) {
     NUM_CHANNELS = std::stoi(argv[5]);
   }
+  if (argc >= 7) {
+    HWTSP_RATE = std::stod(argv[6]);
+  }
+  if (argc >= 8) {
+    NUM_ITERATIONS = std::stoi(argv[7]);
+  }
 
   if (NUM_CHANNELS == 1) {
     PHYSICAL_CHANNEL_READ = READ_DEVICE + "/ai0";
@@ -246,6 +273,9 @@ int main(int argc, char **argv)
   std::cout << "  Number of channels: " << NUM_CHANNELS << "\n";
   std::cout << "  Read channel: " << PHYSICAL_CHANNEL_READ << "\n";
   std::cout << "  Write channel: " << PHYSICAL_CHANNEL_WRITE << "\n";
+  if (HWTSP_RATE > 0) {
+    std::cout << "  HWTSP rate: " << HWTSP_RATE << " Hz\n";
+  }
 
   auto channel = grpc::CreateChannel(target_str, grpc::InsecureChannelCredentials());
   NiDAQmx::Stub client(channel);
@@ -317,6 +347,20 @@ int main(int argc, char **argv)
     ni::data_monikers::BeginMonikerSidebandStreamRequest sideband_request;
     ni::data_monikers::BeginMonikerSidebandStreamResponse sideband_response;
     sideband_request.set_strategy(ni::data_monikers::SidebandStrategy::SOCKETS_LOW_LATENCY);
+    if (HWTSP_RATE > 0) {
+      // Read monikers run in order each tick, so the server waits for the
+      // sample clock before it reads the inputs.
+      std::cout << "Set up Wait For Next Sample Clock Moniker" << std::endl;
+      ::grpc::ClientContext begin_wait_context;
+      auto begin_wait_request = BeginWaitForNextSampleClockRequest{};
+      begin_wait_request.mutable_task()->CopyFrom(daqmx_read_task);
+      begin_wait_request.set_timeout(10.0);
+      auto begin_wait_response = BeginWaitForNextSampleClockResponse{};
+      raise_if_error(
+        client.BeginWaitForNextSampleClock(&begin_wait_context, begin_wait_request, &begin_wait_response),
+        begin_wait_context);
+      sideband_request.mutable_monikers()->mutable_read_monikers()->AddAllocated(new ni::data_monikers::Moniker(begin_wait_response.moniker()));
+    }
     sideband_request.mutable_monikers()->mutable_read_monikers()->AddAllocated(daqmx_read_moniker);
     sideband_request.mutable_monikers()->mutable_write_monikers()->AddAllocated(daqmx_write_moniker);
     auto write_stream = moniker_service.BeginSidebandStream(&moniker_context, sideband_request, &sideband_response);
@@ -325,10 +369,43 @@ int main(int argc, char **argv)
     }
     auto sideband_token = InitClientSidebandData(sideband_response);
     std::cout << "InitClientSidebandData complete with token " << sideband_token << std::endl;
+    SidebandLatencyRecorder::Instance().Enable(true);
     
 
+    if (HWTSP_RATE > 0) {
+      // AI read -> callback -> AO write once per sample clock tick, the
+      // callback here just loops the inputs back to the outputs.
+      std::cout << "PREEMPT_RT kernel: " << (SidebandThread_IsRealtimeKernel() ? "yes" : "no") << std::endl;
+      SidebandThreadPolicy loop_policy = { -1, 80, true };
+      if (SidebandThread_ApplyPolicyToCurrentThread(loop_policy) != 0) {
+        std::cout << "Could not raise the loop thread to SCHED_FIFO and lock memory, running without them" << std::endl;
+      }
+      SidebandControlLoop control_loop(HWTSP_RATE);
+      nidaqmx_grpc::MonikerWriteAnalogF64Request first_write_f64;
+      first_write_f64.mutable_write_array()->Add(write_data_float64.begin(), write_data_float64.end());
+      ni::data_monikers::SidebandWriteRequest first_write;
+      first_write.mutable_values()->add_values()->PackFrom(first_write_f64);
+      control_loop.Run(sideband_token, NUM_ITERATIONS, first_write,
+        [&](const ni::data_monikers::SidebandReadResponse& read, ni::data_monikers::SidebandWriteRequest* write) {
+          MonikerWaitForNextSampleClockResponse wait_response;
+          MonikerReadAnalogF64Response read_response;
+          if (read.values().values_size() < 2 || !read.values().values(0).UnpackTo(&wait_response) || !read.values().values(1).UnpackTo(&read_response)) {
+            return false;
+          }
+          if (wait_response.is_late()) {
+            control_loop.MarkLate();
+          }
+          nidaqmx_grpc::MonikerWriteAnalogF64Request write_f64;
+          write_f64.mutable_write_array()->CopyFrom(read_response.read_array());
+          write->mutable_values()->add_values()->PackFrom(write_f64);
+          return true;
+        });
+      std::cout << "Control loop:" << std::endl;
+      control_loop.WriteSummary(std::cout);
+    }
+
     // Read data and write data
-    for (int i = 0; i < NUM_ITERATIONS; i++) {
+    for (int i = 0; HWTSP_RATE <= 0 && i < NUM_ITERATIONS; i++) {
       ni::data_monikers::MonikerReadResponse read_data_result;
       nidaqmx_grpc::MonikerWriteAnalogF64Request write_values_array_f64;
       ni::data_monikers::SidebandWriteRequest sideband_request;
@@ -337,12 +414,10 @@ int main(int argc, char **argv)
       write_values_array_f64.mutable_write_array()->Add(write_data_float64.begin(), write_data_float64.end());
       sideband_request.mutable_values()->add_values()->PackFrom(write_values_array_f64);
 
-      WriteSidebandMessage(sideband_token, sideband_request);
-       std::cout << "Write Sideband Message done" << std::endl;
-
       MonikerReadAnalogF64Response read_analog_f64_response;
       ni::data_monikers::SidebandReadResponse read_result;
-      ReadSidebandMessage(sideband_token, &read_result);
+      WriteReadSidebandMessage(sideband_token, sideband_request, &read_result);
+       std::cout << "Write/Read Sideband Message done" << std::endl;
       auto status = read_result.values().values(0).UnpackTo(&read_analog_f64_response);
    
         std::cout << "Status of Unpack" << status << std::endl;
@@ -355,7 +430,10 @@ int main(int argc, char **argv)
     ni::data_monikers::SidebandWriteRequest cancel_request;
     cancel_request.set_cancel(true);
     WriteSidebandMessage(sideband_token, cancel_request);
-    CloseSidebandData(sideband_token);
+    CloseClientSidebandData(sideband_token);
+
+    std::cout << "Sideband latency:" << std::endl;
+    SidebandLatencyRecorder::Instance().WriteSummary(std::cout);
     auto request_read = BeginReadAnalogF64Request{};
 
     std::cout << "Cleaning up." << std::endl;
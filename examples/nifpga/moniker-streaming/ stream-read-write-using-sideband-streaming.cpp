@@ -226,6 +226,7 @@ int main(int argc, char **argv)
     }
     auto sideband_token = InitClientSidebandData(sideband_response);
     std::cout << "InitClientSidebandData complete with token " << sideband_token << std::endl;
+    SidebandLatencyRecorder::Instance().Enable(true);
     
 
     //Read data and write data
@@ -242,12 +243,10 @@ int main(int argc, char **argv)
       sideband_request.mutable_values()->add_values()->PackFrom(write_values_u8);
       
 
-      WriteSidebandMessage(sideband_token, sideband_request);
-       std::cout << "Write Sideband Message done" << std::endl;
-
       MonikerReadArrayI64Response read_array_i64_response;
       ni::data_monikers::SidebandReadResponse read_result;
-      ReadSidebandMessage(sideband_token, &read_result);
+      WriteReadSidebandMessage(sideband_token, sideband_request, &read_result);
+       std::cout << "Write/Read Sideband Message done" << std::endl;
       auto status = read_result.values().values(0).UnpackTo(&read_array_i64_response);
 
         std::cout << "Status of Unpack" << status << std::endl;
@@ -260,7 +259,10 @@ int main(int argc, char **argv)
     ni::data_monikers::SidebandWriteRequest cancel_request;
     cancel_request.set_cancel(true);
     WriteSidebandMessage(sideband_token, cancel_request);
-    CloseSidebandData(sideband_token);
+    CloseClientSidebandData(sideband_token);
+
+    std::cout << "Sideband latency:" << std::endl;
+    SidebandLatencyRecorder::Instance().WriteSummary(std::cout);
     
 
     std::cout << "Cleaning up." << std::endl;
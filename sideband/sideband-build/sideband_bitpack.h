@@ -0,0 +1,257 @@
+#pragma once
+
+//---------------------------------------------------------------------
+//---------------------------------------------------------------------
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    #include <emmintrin.h>
+    #define SIDEBAND_BITPACK_SSE2 1
+#endif
+
+//---------------------------------------------------------------------
+// Packed encoding for the bytes packed_read_array fields of the integer
+// monikers.  Samples are delta coded against the previous sample, zigzag
+// mapped, offset by the smallest value in each block of 128 (frame of
+// reference) and bit packed at the width of the largest remaining value.
+//
+// Layout:  uint32 count, then per block uint8 bitWidth, uint32 reference
+// and 16 * bitWidth bytes of packed data.  Inside a block value i is in
+// lane i % 4 of a four word vector, so the decoder unpacks four samples
+// per instruction.  The last block is zero padded to 128 values.
+//---------------------------------------------------------------------
+class SidebandBitPack
+{
+public:
+    static const int BlockSize = 128;
+
+    inline static int64_t EncodeBound(int64_t count)
+    {
+        return sizeof(uint32_t) + ((count + BlockSize - 1) / BlockSize) * (1 + sizeof(uint32_t) + BlockSize * sizeof(uint32_t));
+    }
+
+    inline static void Encode(const uint32_t* values, int64_t count, std::string* packed)
+    {
+        packed->resize((size_t)EncodeBound(count));
+        auto out = reinterpret_cast<uint8_t*>(&(*packed)[0]);
+        auto start = out;
+        WriteU32(out, (uint32_t)count);
+        out += sizeof(uint32_t);
+
+        uint32_t previous = 0;
+        uint32_t block[BlockSize];
+        for (int64_t offset = 0; offset < count; offset += BlockSize)
+        {
+            auto blockCount = count - offset < BlockSize ? (int)(count - offset) : BlockSize;
+            uint32_t reference = UINT32_MAX;
+            for (int x = 0; x < blockCount; ++x)
+            {
+                auto delta = (int32_t)(values[offset + x] - previous);
+                previous = values[offset + x];
+                block[x] = ((uint32_t)delta << 1) ^ (uint32_t)(delta >> 31);
+                reference = block[x] < reference ? block[x] : reference;
+            }
+            uint32_t bits = 0;
+            for (int x = 0; x < blockCount; ++x)
+            {
+                block[x] -= reference;
+                bits |= block[x];
+            }
+            for (int x = blockCount; x < BlockSize; ++x)
+            {
+                block[x] = 0;
+            }
+            auto bitWidth = BitWidth(bits);
+            *out++ = (uint8_t)bitWidth;
+            WriteU32(out, reference);
+            out += sizeof(uint32_t);
+            out = PackBlock(block, bitWidth, out);
+        }
+        packed->resize(out - start);
+    }
+
+    // Returns the number of values, or -1 if the buffer is malformed.
+    // Every block takes at least its bit width and reference, so a count
+    // needing more blocks than the buffer can hold is rejected here,
+    // before anything is sized from it.
+    inline static int64_t DecodedCount(const std::string& packed)
+    {
+        if (packed.size() < sizeof(uint32_t))
+        {
+            return -1;
+        }
+        int64_t count = ReadU32(reinterpret_cast<const uint8_t*>(packed.data()));
+        int64_t maxBlocks = (int64_t)(packed.size() - sizeof(uint32_t)) / (1 + (int64_t)sizeof(uint32_t));
+        if ((count + BlockSize - 1) / BlockSize > maxBlocks)
+        {
+            return -1;
+        }
+        return count;
+    }
+
+    // values must hold DecodedCount rounded up to a multiple of BlockSize.
+    inline static int64_t Decode(const std::string& packed, uint32_t* values)
+    {
+        auto count = DecodedCount(packed);
+        if (count < 0)
+        {
+            return -1;
+        }
+        auto in = reinterpret_cast<const uint8_t*>(packed.data()) + sizeof(uint32_t);
+        auto end = reinterpret_cast<const uint8_t*>(packed.data()) + packed.size();
+        uint32_t previous = 0;
+        for (int64_t offset = 0; offset < count; offset += BlockSize)
+        {
+            if (end - in < 1 + (int64_t)sizeof(uint32_t))
+            {
+                return -1;
+            }
+            int bitWidth = *in++;
+            auto reference = ReadU32(in);
+            in += sizeof(uint32_t);
+            if (bitWidth > 32 || end - in < bitWidth * 16)
+            {
+                return -1;
+            }
+            in = UnpackBlock(in, bitWidth, reference, &previous, values + offset);
+        }
+        return count;
+    }
+
+    inline static bool Decode(const std::string& packed, std::vector<uint32_t>* values)
+    {
+        auto count = DecodedCount(packed);
+        if (count < 0)
+        {
+            return false;
+        }
+        values->resize((size_t)((count + BlockSize - 1) / BlockSize * BlockSize));
+        if (Decode(packed, values->data()) != count)
+        {
+            values->clear();
+            return false;
+        }
+        values->resize((size_t)count);
+        return true;
+    }
+
+private:
+    inline static void WriteU32(uint8_t* out, uint32_t value)
+    {
+        std::memcpy(out, &value, sizeof(value));
+    }
+
+    inline static uint32_t ReadU32(const uint8_t* in)
+    {
+        uint32_t value;
+        std::memcpy(&value, in, sizeof(value));
+        return value;
+    }
+
+    inline static int BitWidth(uint32_t value)
+    {
+        int bits = 0;
+        while (value != 0)
+        {
+            ++bits;
+            value >>= 1;
+        }
+        return bits;
+    }
+
+    inline static uint8_t* PackBlock(const uint32_t* block, int bitWidth, uint8_t* out)
+    {
+        if (bitWidth == 0)
+        {
+            return out;
+        }
+        for (int lane = 0; lane < 4; ++lane)
+        {
+            uint32_t word = 0;
+            int shift = 0;
+            int wordIndex = 0;
+            for (int x = lane; x < BlockSize; x += 4)
+            {
+                word |= block[x] << shift;
+                shift += bitWidth;
+                if (shift >= 32)
+                {
+                    WriteU32(out + (wordIndex * 4 + lane) * sizeof(uint32_t), word);
+                    ++wordIndex;
+                    shift -= 32;
+                    word = shift > 0 ? block[x] >> (bitWidth - shift) : 0;
+                }
+            }
+        }
+        return out + bitWidth * 16;
+    }
+
+#ifdef SIDEBAND_BITPACK_SSE2
+    inline static const uint8_t* UnpackBlock(const uint8_t* in, int bitWidth, uint32_t reference, uint32_t* previous, uint32_t* out)
+    {
+        auto words = reinterpret_cast<const __m128i*>(in);
+        auto mask = _mm_set1_epi32(bitWidth == 32 ? -1 : (int)((1u << bitWidth) - 1));
+        auto base = _mm_set1_epi32((int)reference);
+        auto one = _mm_set1_epi32(1);
+        auto running = _mm_set1_epi32((int)*previous);
+        auto word = bitWidth > 0 ? _mm_loadu_si128(words++) : _mm_setzero_si128();
+        int shift = 0;
+        for (int x = 0; x < BlockSize / 4; ++x)
+        {
+            auto value = _mm_srl_epi32(word, _mm_cvtsi32_si128(shift));
+            shift += bitWidth;
+            if (shift >= 32 && (x < BlockSize / 4 - 1 || shift > 32))
+            {
+                shift -= 32;
+                word = _mm_loadu_si128(words++);
+                if (shift > 0)
+                {
+                    value = _mm_or_si128(value, _mm_sll_epi32(word, _mm_cvtsi32_si128(bitWidth - shift)));
+                }
+            }
+            value = _mm_add_epi32(_mm_and_si128(value, mask), base);
+            value = _mm_xor_si128(_mm_srli_epi32(value, 1), _mm_sub_epi32(_mm_setzero_si128(), _mm_and_si128(value, one)));
+            value = _mm_add_epi32(value, _mm_slli_si128(value, 4));
+            value = _mm_add_epi32(value, _mm_slli_si128(value, 8));
+            running = _mm_add_epi32(value, running);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + x * 4), running);
+            running = _mm_shuffle_epi32(running, _MM_SHUFFLE(3, 3, 3, 3));
+        }
+        *previous = (uint32_t)_mm_cvtsi128_si32(running);
+        return in + bitWidth * 16;
+    }
+#else
+    inline static const uint8_t* UnpackBlock(const uint8_t* in, int bitWidth, uint32_t reference, uint32_t* previous, uint32_t* out)
+    {
+        uint32_t mask = bitWidth == 32 ? UINT32_MAX : (1u << bitWidth) - 1;
+        for (int lane = 0; lane < 4; ++lane)
+        {
+            int wordIndex = 0;
+            int shift = 0;
+            for (int x = lane; x < BlockSize; x += 4)
+            {
+                uint32_t value = bitWidth > 0 ? ReadU32(in + (wordIndex * 4 + lane) * sizeof(uint32_t)) >> shift : 0;
+                shift += bitWidth;
+                if (shift >= 32)
+                {
+                    ++wordIndex;
+                    shift -= 32;
+                    if (shift > 0)
+                    {
+                        value |= ReadU32(in + (wordIndex * 4 + lane) * sizeof(uint32_t)) << (bitWidth - shift);
+                    }
+                }
+                out[x] = (value & mask) + reference;
+            }
+        }
+        for (int x = 0; x < BlockSize; ++x)
+        {
+            *previous += (out[x] >> 1) ^ (0 - (out[x] & 1));
+            out[x] = *previous;
+        }
+        return in + bitWidth * 16;
+    }
+#endif
+};
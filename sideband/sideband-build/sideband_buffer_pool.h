@@ -0,0 +1,270 @@
+#pragma once
+
+//---------------------------------------------------------------------
+//---------------------------------------------------------------------
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+//---------------------------------------------------------------------
+// Process wide pool of serialize buffers in power of two size classes.
+// Buffers are handed out per message instead of one max sized buffer per
+// stream, so memory follows the data in flight rather than the number of
+// open streams.
+//---------------------------------------------------------------------
+class SidebandBufferPool
+{
+public:
+    static const int MinClassMagnitude = 12;
+    static const int MaxClassMagnitude = 26;
+    static const int ClassCount = MaxClassMagnitude - MinClassMagnitude + 1;
+    static const size_t MaxFreeBuffersPerClass = 8;
+
+    //---------------------------------------------------------------------
+    //---------------------------------------------------------------------
+    class Lease
+    {
+    public:
+        Lease()
+            : _pool(nullptr), _sizeClass(-1), _capacity(0)
+        {
+        }
+
+        Lease(Lease&& other) noexcept
+            : _pool(other._pool), _sizeClass(other._sizeClass), _capacity(other._capacity), _buffer(std::move(other._buffer))
+        {
+            other._pool = nullptr;
+            other._capacity = 0;
+        }
+
+        Lease& operator=(Lease&& other) noexcept
+        {
+            if (this != &other)
+            {
+                Release();
+                _pool = other._pool;
+                _sizeClass = other._sizeClass;
+                _capacity = other._capacity;
+                _buffer = std::move(other._buffer);
+                other._pool = nullptr;
+                other._capacity = 0;
+            }
+            return *this;
+        }
+
+        Lease(const Lease&) = delete;
+        Lease& operator=(const Lease&) = delete;
+
+        ~Lease()
+        {
+            Release();
+        }
+
+        inline uint8_t* Data() const { return _buffer.get(); }
+        inline int64_t Capacity() const { return _capacity; }
+        inline bool Fits(int64_t byteCount) const { return byteCount >= 0 && byteCount <= _capacity; }
+
+        inline void Release()
+        {
+            if (_pool != nullptr && _buffer)
+            {
+                _pool->Return(_sizeClass, std::move(_buffer));
+            }
+            _pool = nullptr;
+            _buffer.reset();
+            _capacity = 0;
+        }
+
+    private:
+        friend class SidebandBufferPool;
+
+        Lease(SidebandBufferPool* pool, int sizeClass, int64_t capacity, std::unique_ptr<uint8_t[]> buffer)
+            : _pool(pool), _sizeClass(sizeClass), _capacity(capacity), _buffer(std::move(buffer))
+        {
+        }
+
+        SidebandBufferPool* _pool;
+        int _sizeClass;
+        int64_t _capacity;
+        std::unique_ptr<uint8_t[]> _buffer;
+    };
+
+public:
+    static SidebandBufferPool& Instance()
+    {
+        static SidebandBufferPool pool;
+        return pool;
+    }
+
+    // allocated is set when no pooled buffer was available and a new one
+    // had to be created.  Requests larger than the biggest class are
+    // allocated exactly and freed on release.
+    inline Lease Acquire(int64_t byteCount, bool* allocated = nullptr)
+    {
+        if (allocated != nullptr)
+        {
+            *allocated = false;
+        }
+        if (byteCount < 0)
+        {
+            return Lease();
+        }
+        int sizeClass = SizeClass(byteCount);
+        if (sizeClass < 0)
+        {
+            if (allocated != nullptr)
+            {
+                *allocated = true;
+            }
+            return Lease(nullptr, -1, byteCount, std::unique_ptr<uint8_t[]>(new uint8_t[byteCount]));
+        }
+        auto capacity = ClassCapacity(sizeClass);
+        {
+            auto& freeList = _classes[sizeClass];
+            std::lock_guard<std::mutex> lock(freeList.mutex);
+            if (!freeList.buffers.empty())
+            {
+                auto buffer = std::move(freeList.buffers.back());
+                freeList.buffers.pop_back();
+                return Lease(this, sizeClass, capacity, std::move(buffer));
+            }
+        }
+        if (allocated != nullptr)
+        {
+            *allocated = true;
+        }
+        return Lease(this, sizeClass, capacity, std::unique_ptr<uint8_t[]>(new uint8_t[capacity]));
+    }
+
+    inline void Trim()
+    {
+        for (auto& freeList : _classes)
+        {
+            std::lock_guard<std::mutex> lock(freeList.mutex);
+            freeList.buffers.clear();
+        }
+    }
+
+private:
+    struct FreeList
+    {
+        std::mutex mutex;
+        std::vector<std::unique_ptr<uint8_t[]>> buffers;
+    };
+
+    SidebandBufferPool() = default;
+
+    inline static int64_t ClassCapacity(int sizeClass)
+    {
+        return (int64_t)1 << (sizeClass + MinClassMagnitude);
+    }
+
+    inline static int SizeClass(int64_t byteCount)
+    {
+        for (int sizeClass = 0; sizeClass < ClassCount; ++sizeClass)
+        {
+            if (byteCount <= ClassCapacity(sizeClass))
+            {
+                return sizeClass;
+            }
+        }
+        return -1;
+    }
+
+    inline void Return(int sizeClass, std::unique_ptr<uint8_t[]> buffer)
+    {
+        auto& freeList = _classes[sizeClass];
+        std::lock_guard<std::mutex> lock(freeList.mutex);
+        if (freeList.buffers.size() < MaxFreeBuffersPerClass)
+        {
+            freeList.buffers.push_back(std::move(buffer));
+        }
+    }
+
+private:
+    std::array<FreeList, ClassCount> _classes;
+};
+
+//---------------------------------------------------------------------
+// Buffer size of each stream, as negotiated in
+// BeginMonikerSidebandStreamResponse.buffer_size.  It bounds the length
+// prefixes a reader will allocate for and the frames a writer may put
+// in a direct write buffer.  Client tokens are registered by
+// InitClientSidebandData, server tokens by GetOwnerSidebandDataToken
+// with the buffer size and fan-out producers by
+// InitFanoutOwnerSidebandData with their largest frame.  Reads on
+// unregistered tokens are bounded by the largest pooled buffer.
+//---------------------------------------------------------------------
+class SidebandFrameLimits
+{
+public:
+    static const int64_t DefaultReadLimit = (int64_t)1 << SidebandBufferPool::MaxClassMagnitude;
+
+    static SidebandFrameLimits& Instance()
+    {
+        static SidebandFrameLimits limits;
+        return limits;
+    }
+
+    inline void Set(int64_t dataToken, int64_t bufferSize)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (bufferSize <= 0)
+        {
+            _bufferSizes.erase(dataToken);
+        }
+        else
+        {
+            _bufferSizes[dataToken] = bufferSize;
+        }
+        _count.store((int64_t)_bufferSizes.size(), std::memory_order_relaxed);
+    }
+
+    // Buffer size of the stream, 0 if it was not registered.
+    inline int64_t Get(int64_t dataToken)
+    {
+        if (_count.load(std::memory_order_relaxed) == 0)
+        {
+            return 0;
+        }
+        std::lock_guard<std::mutex> lock(_mutex);
+        auto it = _bufferSizes.find(dataToken);
+        return it == _bufferSizes.end() ? 0 : it->second;
+    }
+
+    // Largest frame a reader accepts on dataToken.
+    inline int64_t ReadLimit(int64_t dataToken)
+    {
+        auto bufferSize = Get(dataToken);
+        return bufferSize > 0 ? bufferSize : DefaultReadLimit;
+    }
+
+    // Whether a frame of frameSize fits the direct write buffer of
+    // dataToken, which is as large as the stream buffer.  Unregistered
+    // tokens are never known to fit.
+    inline bool FitsDirectWrite(int64_t dataToken, int64_t frameSize)
+    {
+        auto bufferSize = Get(dataToken);
+        return bufferSize > 0 && frameSize >= 0 && frameSize <= bufferSize;
+    }
+
+    inline void Remove(int64_t dataToken)
+    {
+        Set(dataToken, 0);
+    }
+
+private:
+    SidebandFrameLimits()
+        : _count(0)
+    {
+    }
+
+private:
+    std::mutex _mutex;
+    std::atomic<int64_t> _count;
+    std::unordered_map<int64_t, int64_t> _bufferSizes;
+};
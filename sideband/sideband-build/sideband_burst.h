@@ -0,0 +1,91 @@
+#pragma once
+
+//---------------------------------------------------------------------
+//---------------------------------------------------------------------
+#include <cstdint>
+
+//---------------------------------------------------------------------
+// Sizes the fetches of a continuous acquisition moniker from the
+// driver's backlog (for example nirfsa GetFetchBacklog).  Each read of
+// the moniker takes whatever has accumulated, so the stream keeps up
+// with the acquisition without a fixed block size: small fetches while
+// the client keeps up, large ones when it falls behind.
+//
+// minimum bounds the per frame overhead, the fetch then waits for that
+// many samples.  maximum bounds the frame size and should fit the
+// sideband buffer.  Counts are rounded down to granularity; minimum is
+// rounded up to it, and maximum is raised to minimum if it ends up
+// smaller, so every count is a non zero multiple of granularity.
+//---------------------------------------------------------------------
+class SidebandBurstSizer
+{
+public:
+    SidebandBurstSizer(int64_t minimum, int64_t maximum, int64_t granularity = 1)
+        : _granularity(granularity < 1 ? 1 : granularity)
+    {
+        _minimum = minimum < _granularity ? _granularity : (minimum + _granularity - 1) / _granularity * _granularity;
+        _maximum = maximum - maximum % _granularity;
+        _maximum = _maximum < _minimum ? _minimum : _maximum;
+    }
+
+    inline int64_t Next(int64_t backlog) const
+    {
+        auto count = backlog - backlog % _granularity;
+        if (count < _minimum)
+        {
+            return _minimum;
+        }
+        return count > _maximum ? _maximum : count;
+    }
+
+    inline int64_t Minimum() const { return _minimum; }
+    inline int64_t Maximum() const { return _maximum; }
+
+private:
+    int64_t _granularity;
+    int64_t _minimum;
+    int64_t _maximum;
+};
+
+//---------------------------------------------------------------------
+// Flow control for a streaming write moniker (for example nifgen
+// BeginWriteBinary16Waveform).  Every write response reports the free
+// space left in the device's circular buffer
+// (STREAMING_SPACE_AVAILABLE_IN_WAVEFORM), which becomes the credit for
+// the next writes.  Take hands out at most that many samples so a write
+// never blocks in the driver and the generation never underflows as
+// long as the host keeps the credits used.  Counts are rounded down to
+// granularity, the write quantum of the device.
+//---------------------------------------------------------------------
+class SidebandWriteCredits
+{
+public:
+    SidebandWriteCredits(int64_t initialCredits, int64_t granularity = 1)
+        : _credits(initialCredits < 0 ? 0 : initialCredits), _granularity(granularity < 1 ? 1 : granularity)
+    {
+    }
+
+    // Records the free space reported by the latest write response.
+    // Samples taken after that write was sent are still outstanding.
+    inline void Update(int64_t spaceAvailable, int64_t outstanding = 0)
+    {
+        auto credits = spaceAvailable - outstanding;
+        _credits = credits < 0 ? 0 : credits;
+    }
+
+    // Number of samples the next write may carry, up to maximum, and
+    // removes them from the credits.  0 means wait for the next update.
+    inline int64_t Take(int64_t maximum)
+    {
+        auto count = maximum < _credits ? maximum : _credits;
+        count -= count % _granularity;
+        _credits -= count;
+        return count;
+    }
+
+    inline int64_t Available() const { return _credits; }
+
+private:
+    int64_t _credits;
+    int64_t _granularity;
+};
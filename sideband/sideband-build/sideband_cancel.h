@@ -0,0 +1,314 @@
+#pragma once
+
+//---------------------------------------------------------------------
+//---------------------------------------------------------------------
+#ifdef _WIN32
+    #ifndef WIN32_LEAN_AND_MEAN
+        #define WIN32_LEAN_AND_MEAN
+    #endif
+    #include <winsock2.h>
+    #pragma comment(lib, "Ws2_32.lib")
+#else
+    #include <poll.h>
+    #include <sys/socket.h>
+#endif
+
+//---------------------------------------------------------------------
+//---------------------------------------------------------------------
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include "sideband_data.h"
+
+//---------------------------------------------------------------------
+// Results of the timed and cancellable calls, next to 0 for success and
+// -1 for failure.  SIDEBAND_NOT_SUPPORTED is returned for tokens the
+// helpers cannot wait on, see SidebandCancelTable.
+//---------------------------------------------------------------------
+#define SIDEBAND_TIMED_OUT -2
+#define SIDEBAND_CANCELLED -3
+#define SIDEBAND_NOT_SUPPORTED -4
+
+//---------------------------------------------------------------------
+// Implemented by the SidebandData types defined in these headers so a
+// blocked reader or writer can be woken from another thread.
+//---------------------------------------------------------------------
+class SidebandInterruptible
+{
+public:
+    virtual ~SidebandInterruptible() = default;
+
+    // Waits until the next read would not block, timeoutMicroseconds < 0
+    // waits forever.  Returns 0, SIDEBAND_TIMED_OUT or SIDEBAND_CANCELLED,
+    // or -1 if the token cannot be read.
+    virtual int32_t WaitForData(int64_t timeoutMicroseconds)
+    {
+        return -1;
+    }
+
+    // Wakes every thread blocked on this token.  Reads return a cancel
+    // frame and writes fail from then on.
+    virtual void Cancel() = 0;
+};
+
+//---------------------------------------------------------------------
+// Returns 0 once the socket is readable (or writable), or
+// SIDEBAND_TIMED_OUT.  A socket that was shut down reports readable, the
+// read that follows fails.
+//---------------------------------------------------------------------
+inline int32_t SidebandSocketWait(uint64_t socket, bool forWrite, int64_t timeoutMicroseconds)
+{
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::microseconds(timeoutMicroseconds);
+    while (true)
+    {
+        int timeoutMilliseconds = -1;
+        if (timeoutMicroseconds >= 0)
+        {
+            auto remaining = std::chrono::duration_cast<std::chrono::microseconds>(deadline - std::chrono::steady_clock::now()).count();
+            timeoutMilliseconds = remaining <= 0 ? 0 : (int)((remaining + 999) / 1000);
+        }
+#ifdef _WIN32
+        WSAPOLLFD descriptor = {};
+        descriptor.fd = (SOCKET)socket;
+        descriptor.events = forWrite ? POLLWRNORM : POLLRDNORM;
+        auto result = WSAPoll(&descriptor, 1, timeoutMilliseconds);
+#else
+        pollfd descriptor = {};
+        descriptor.fd = (int)socket;
+        descriptor.events = forWrite ? POLLOUT : POLLIN;
+        auto result = poll(&descriptor, 1, timeoutMilliseconds);
+        if (result < 0 && errno == EINTR)
+        {
+            continue;
+        }
+#endif
+        if (result != 0)
+        {
+            return 0;
+        }
+        if (timeoutMilliseconds == 0)
+        {
+            return SIDEBAND_TIMED_OUT;
+        }
+    }
+}
+
+//---------------------------------------------------------------------
+// Shuts socket down in both directions, which wakes the helpers polling
+// it in SidebandData_WaitForData and a SidebandClientSocketData blocked
+// in recv or send; their calls fail from then on, sends with
+// MSG_NOSIGNAL so no SIGPIPE is raised.  Only sockets the helpers read
+// and write themselves are passed here: the library retries a recv that
+// returns 0 and sends without MSG_NOSIGNAL.
+//---------------------------------------------------------------------
+inline void SidebandSocketInterrupt(uint64_t socket)
+{
+#ifdef _WIN32
+    shutdown((SOCKET)socket, SD_BOTH);
+#else
+    shutdown((int)socket, SHUT_RDWR);
+#endif
+}
+
+//---------------------------------------------------------------------
+// Client tokens whose transport the helpers can reach: sockets connected
+// by InitCancellableClientSidebandData, and the SidebandInterruptible
+// types (fan-out and replay).  Tokens created inside the sideband
+// library (sockets, shared memory and RDMA) are not listed; its blocking
+// calls cannot be waited on or woken from outside, so the timed calls
+// and SidebandData_Cancel return SIDEBAND_NOT_SUPPORTED for them.
+//---------------------------------------------------------------------
+class SidebandCancelTable
+{
+public:
+    struct Entry
+    {
+        std::atomic<bool> cancelled { false };
+        bool hasSocket = false;
+        uint64_t socket = 0;
+        SidebandInterruptible* interruptible = nullptr;
+    };
+
+    static SidebandCancelTable& Instance()
+    {
+        static SidebandCancelTable table;
+        return table;
+    }
+
+    inline void AddSocket(int64_t dataToken, uint64_t socket)
+    {
+        auto entry = std::make_shared<Entry>();
+        entry->hasSocket = true;
+        entry->socket = socket;
+        Add(dataToken, entry);
+    }
+
+    inline void AddInterruptible(int64_t dataToken, SidebandInterruptible* interruptible)
+    {
+        auto entry = std::make_shared<Entry>();
+        entry->interruptible = interruptible;
+        Add(dataToken, entry);
+    }
+
+    inline std::shared_ptr<Entry> Find(int64_t dataToken)
+    {
+        if (_count.load(std::memory_order_relaxed) == 0)
+        {
+            return nullptr;
+        }
+        std::lock_guard<std::mutex> lock(_mutex);
+        auto it = _entries.find(dataToken);
+        return it == _entries.end() ? nullptr : it->second;
+    }
+
+    inline void Remove(int64_t dataToken)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _entries.erase(dataToken);
+        _count.store((int64_t)_entries.size(), std::memory_order_relaxed);
+    }
+
+private:
+    SidebandCancelTable()
+        : _count(0)
+    {
+    }
+
+    inline void Add(int64_t dataToken, const std::shared_ptr<Entry>& entry)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _entries[dataToken] = entry;
+        _count.store((int64_t)_entries.size(), std::memory_order_relaxed);
+    }
+
+private:
+    std::mutex _mutex;
+    std::atomic<int64_t> _count;
+    std::unordered_map<int64_t, std::shared_ptr<Entry>> _entries;
+};
+
+//---------------------------------------------------------------------
+// Wakes every thread waiting on dataToken.  Sockets from
+// InitCancellableClientSidebandData are shut down with
+// SidebandSocketInterrupt, fan-out and replay tokens wake the threads
+// sleeping on them through SidebandInterruptible::Cancel.  Reads and
+// writes fail from then on.  The token still has to be closed
+// afterwards, and must not be closed while this call is running.
+// Returns SIDEBAND_NOT_SUPPORTED for every other token, including the
+// library's socket and shared memory tokens.
+//---------------------------------------------------------------------
+inline int32_t SidebandData_Cancel(int64_t dataToken)
+{
+    auto entry = SidebandCancelTable::Instance().Find(dataToken);
+    if (entry == nullptr)
+    {
+        return SIDEBAND_NOT_SUPPORTED;
+    }
+    if (entry->hasSocket && !entry->cancelled.exchange(true, std::memory_order_seq_cst))
+    {
+        SidebandSocketInterrupt(entry->socket);
+    }
+    entry->cancelled.store(true, std::memory_order_seq_cst);
+    if (entry->interruptible != nullptr)
+    {
+        entry->interruptible->Cancel();
+    }
+    return 0;
+}
+
+//---------------------------------------------------------------------
+//---------------------------------------------------------------------
+inline int32_t SidebandData_IsCancelled(int64_t dataToken)
+{
+    auto entry = SidebandCancelTable::Instance().Find(dataToken);
+    return entry != nullptr && entry->cancelled.load(std::memory_order_acquire) ? 1 : 0;
+}
+
+//---------------------------------------------------------------------
+// Waits until a frame starts to arrive on dataToken.  The timeout only
+// covers that wait: once the first byte is there the frame is read to
+// the end by the blocking call, however long the rest takes.  Giving up
+// part way would leave the stream in the middle of a frame with no way
+// to find the next one.  Returns SIDEBAND_NOT_SUPPORTED for tokens that
+// are not in SidebandCancelTable.
+//---------------------------------------------------------------------
+inline int32_t SidebandData_WaitForData(int64_t dataToken, int64_t timeoutMilliseconds)
+{
+    auto entry = SidebandCancelTable::Instance().Find(dataToken);
+    if (entry == nullptr)
+    {
+        return SIDEBAND_NOT_SUPPORTED;
+    }
+    if (entry->cancelled.load(std::memory_order_acquire))
+    {
+        return SIDEBAND_CANCELLED;
+    }
+    auto timeoutMicroseconds = timeoutMilliseconds < 0 ? -1 : timeoutMilliseconds * 1000;
+    int32_t result = -1;
+    if (entry->hasSocket)
+    {
+        result = SidebandSocketWait(entry->socket, false, timeoutMicroseconds);
+    }
+    else if (entry->interruptible != nullptr)
+    {
+        result = entry->interruptible->WaitForData(timeoutMicroseconds);
+    }
+    return entry->cancelled.load(std::memory_order_acquire) ? SIDEBAND_CANCELLED : result;
+}
+
+//---------------------------------------------------------------------
+// Maps the result of a blocking call made after SidebandData_WaitForData.
+//---------------------------------------------------------------------
+inline int32_t SidebandCancelResult(int64_t dataToken, int32_t result)
+{
+    if (result != 0 && SidebandData_IsCancelled(dataToken) == 1)
+    {
+        return SIDEBAND_CANCELLED;
+    }
+    return result;
+}
+
+//---------------------------------------------------------------------
+// Timed variants of the blocking reads.  Each returns 0, -1,
+// SIDEBAND_TIMED_OUT, SIDEBAND_CANCELLED or SIDEBAND_NOT_SUPPORTED; a
+// negative timeout waits forever but can still be cancelled.  As with
+// SidebandData_WaitForData the timeout bounds the wait for the first
+// byte, not the whole read.
+//---------------------------------------------------------------------
+inline int32_t SidebandData_ReadWithTimeout(int64_t dataToken, uint8_t* bytes, int64_t bufferSize, int64_t* numBytesRead, int64_t timeoutMilliseconds)
+{
+    auto result = SidebandData_WaitForData(dataToken, timeoutMilliseconds);
+    if (result != 0)
+    {
+        return result;
+    }
+    return SidebandCancelResult(dataToken, SidebandData_Read(dataToken, bytes, bufferSize, numBytesRead));
+}
+
+//---------------------------------------------------------------------
+//---------------------------------------------------------------------
+inline int32_t SidebandData_ReadLengthPrefixWithTimeout(int64_t dataToken, int64_t* length, int64_t timeoutMilliseconds)
+{
+    auto result = SidebandData_WaitForData(dataToken, timeoutMilliseconds);
+    if (result != 0)
+    {
+        return result;
+    }
+    return SidebandCancelResult(dataToken, SidebandData_ReadLengthPrefix(dataToken, length));
+}
+
+//---------------------------------------------------------------------
+//---------------------------------------------------------------------
+inline int32_t SidebandData_BeginDirectReadLengthPrefixedWithTimeout(int64_t dataToken, int64_t* bufferSize, const uint8_t** buffer, int64_t timeoutMilliseconds)
+{
+    auto result = SidebandData_WaitForData(dataToken, timeoutMilliseconds);
+    if (result != 0)
+    {
+        return result;
+    }
+    return SidebandCancelResult(dataToken, SidebandData_BeginDirectReadLengthPrefixed(dataToken, bufferSize, buffer));
+}
@@ -0,0 +1,291 @@
+#pragma once
+
+//---------------------------------------------------------------------
+//---------------------------------------------------------------------
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <unordered_map>
+
+//---------------------------------------------------------------------
+// Matches ni.data_monikers.SidebandCodec
+//---------------------------------------------------------------------
+enum class SidebandCodec
+{
+    NONE = 0,
+    LZ4 = 1
+};
+
+//---------------------------------------------------------------------
+//---------------------------------------------------------------------
+struct SidebandCodecSettings
+{
+    SidebandCodec codec;
+};
+
+//---------------------------------------------------------------------
+// Header in front of every compressed sideband message.  Each message is
+// compressed on its own, so blocks stay pipelined with the stream.
+//---------------------------------------------------------------------
+struct SidebandCodecHeader
+{
+    uint8_t codec;
+    uint8_t reserved[3];
+    uint32_t uncompressedSize;
+};
+
+//---------------------------------------------------------------------
+// LZ4 block format compressor and decompressor.  Output is compatible
+// with LZ4_compress_default / LZ4_decompress_safe so the other end of
+// the stream is free to use liblz4.
+//---------------------------------------------------------------------
+class SidebandLz4
+{
+public:
+    inline static int64_t CompressBound(int64_t byteCount)
+    {
+        return byteCount + byteCount / 255 + 16;
+    }
+
+    // Returns the compressed size, destination must hold CompressBound(sourceSize) bytes.
+    inline static int64_t Compress(const uint8_t* source, int64_t sourceSize, uint8_t* destination)
+    {
+        uint32_t table[HashTableSize];
+        std::memset(table, 0, sizeof(table));
+
+        const uint8_t* anchor = source;
+        const uint8_t* current = source;
+        const uint8_t* end = source + sourceSize;
+        const uint8_t* matchLimit = end - LastLiterals;
+        const uint8_t* searchLimit = end - MinInputForMatch;
+        uint8_t* out = destination;
+
+        if (sourceSize >= MinInputForMatch)
+        {
+            ++current;
+            while (current < searchLimit)
+            {
+                auto sequence = Read32(current);
+                auto hash = Hash(sequence);
+                const uint8_t* match = source + table[hash];
+                table[hash] = (uint32_t)(current - source);
+                if (match >= current || current - match > MaxOffset || Read32(match) != sequence)
+                {
+                    ++current;
+                    continue;
+                }
+                while (current > anchor && match > source && current[-1] == match[-1])
+                {
+                    --current;
+                    --match;
+                }
+                const uint8_t* matchEnd = current + MinMatch;
+                const uint8_t* reference = match + MinMatch;
+                while (matchEnd < matchLimit && *matchEnd == *reference)
+                {
+                    ++matchEnd;
+                    ++reference;
+                }
+                out = WriteSequence(out, anchor, current - anchor, (uint16_t)(current - match), matchEnd - current);
+                current = matchEnd;
+                anchor = current;
+                if (current < searchLimit)
+                {
+                    table[Hash(Read32(current - 2))] = (uint32_t)(current - 2 - source);
+                }
+            }
+        }
+        out = WriteLastLiterals(out, anchor, end - anchor);
+        return out - destination;
+    }
+
+    // Returns the decompressed size, or -1 if the block is malformed or
+    // does not fit in destinationSize.
+    inline static int64_t Decompress(const uint8_t* source, int64_t sourceSize, uint8_t* destination, int64_t destinationSize)
+    {
+        const uint8_t* in = source;
+        const uint8_t* inEnd = source + sourceSize;
+        uint8_t* out = destination;
+        uint8_t* outEnd = destination + destinationSize;
+
+        while (in < inEnd)
+        {
+            auto token = *in++;
+            int64_t literalLength = token >> 4;
+            if (literalLength == 15 && !ReadLength(&in, inEnd, &literalLength))
+            {
+                return -1;
+            }
+            if (literalLength > inEnd - in || literalLength > outEnd - out)
+            {
+                return -1;
+            }
+            std::memcpy(out, in, (size_t)literalLength);
+            in += literalLength;
+            out += literalLength;
+            if (in == inEnd)
+            {
+                break;
+            }
+            if (inEnd - in < 2)
+            {
+                return -1;
+            }
+            int64_t offset = in[0] | (in[1] << 8);
+            in += 2;
+            if (offset == 0 || offset > out - destination)
+            {
+                return -1;
+            }
+            int64_t matchLength = token & 0x0f;
+            if (matchLength == 15 && !ReadLength(&in, inEnd, &matchLength))
+            {
+                return -1;
+            }
+            matchLength += MinMatch;
+            if (matchLength > outEnd - out)
+            {
+                return -1;
+            }
+            const uint8_t* match = out - offset;
+            for (int64_t x = 0; x < matchLength; ++x)
+            {
+                out[x] = match[x];
+            }
+            out += matchLength;
+        }
+        return out - destination;
+    }
+
+private:
+    static const int MinMatch = 4;
+    static const int LastLiterals = 5;
+    static const int MinInputForMatch = 13;
+    static const int MaxOffset = 65535;
+    static const int HashLog = 12;
+    static const int HashTableSize = 1 << HashLog;
+
+    inline static uint32_t Read32(const uint8_t* bytes)
+    {
+        uint32_t value;
+        std::memcpy(&value, bytes, sizeof(value));
+        return value;
+    }
+
+    inline static uint32_t Hash(uint32_t sequence)
+    {
+        return (sequence * 2654435761U) >> (32 - HashLog);
+    }
+
+    inline static uint8_t* WriteLength(uint8_t* out, int64_t length)
+    {
+        while (length >= 255)
+        {
+            *out++ = 255;
+            length -= 255;
+        }
+        *out++ = (uint8_t)length;
+        return out;
+    }
+
+    inline static bool ReadLength(const uint8_t** in, const uint8_t* inEnd, int64_t* length)
+    {
+        uint8_t next;
+        do
+        {
+            if (*in >= inEnd)
+            {
+                return false;
+            }
+            next = *(*in)++;
+            *length += next;
+        } while (next == 255);
+        return true;
+    }
+
+    inline static uint8_t* WriteSequence(uint8_t* out, const uint8_t* literals, int64_t literalLength, uint16_t offset, int64_t matchLength)
+    {
+        auto token = out++;
+        auto extraMatch = matchLength - MinMatch;
+        *token = (uint8_t)(((literalLength >= 15 ? 15 : literalLength) << 4) | (extraMatch >= 15 ? 15 : extraMatch));
+        if (literalLength >= 15)
+        {
+            out = WriteLength(out, literalLength - 15);
+        }
+        std::memcpy(out, literals, (size_t)literalLength);
+        out += literalLength;
+        *out++ = (uint8_t)(offset & 0xff);
+        *out++ = (uint8_t)(offset >> 8);
+        if (extraMatch >= 15)
+        {
+            out = WriteLength(out, extraMatch - 15);
+        }
+        return out;
+    }
+
+    inline static uint8_t* WriteLastLiterals(uint8_t* out, const uint8_t* literals, int64_t literalLength)
+    {
+        *out++ = (uint8_t)((literalLength >= 15 ? 15 : literalLength) << 4);
+        if (literalLength >= 15)
+        {
+            out = WriteLength(out, literalLength - 15);
+        }
+        std::memcpy(out, literals, (size_t)literalLength);
+        return out + literalLength;
+    }
+};
+
+//---------------------------------------------------------------------
+// Codec negotiated for each client token by BeginSidebandStream.
+//---------------------------------------------------------------------
+class SidebandCodecTable
+{
+public:
+    static SidebandCodecTable& Instance()
+    {
+        static SidebandCodecTable table;
+        return table;
+    }
+
+    inline void Set(int64_t dataToken, SidebandCodec codec)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (codec == SidebandCodec::NONE)
+        {
+            _settings.erase(dataToken);
+        }
+        else
+        {
+            _settings[dataToken] = SidebandCodecSettings { codec };
+        }
+        _count.store((int64_t)_settings.size(), std::memory_order_relaxed);
+    }
+
+    inline SidebandCodecSettings Get(int64_t dataToken)
+    {
+        if (_count.load(std::memory_order_relaxed) == 0)
+        {
+            return SidebandCodecSettings { SidebandCodec::NONE };
+        }
+        std::lock_guard<std::mutex> lock(_mutex);
+        auto it = _settings.find(dataToken);
+        return it == _settings.end() ? SidebandCodecSettings { SidebandCodec::NONE } : it->second;
+    }
+
+    inline void Remove(int64_t dataToken)
+    {
+        Set(dataToken, SidebandCodec::NONE);
+    }
+
+private:
+    SidebandCodecTable()
+        : _count(0)
+    {
+    }
+
+private:
+    std::mutex _mutex;
+    std::atomic<int64_t> _count;
+    std::unordered_map<int64_t, SidebandCodecSettings> _settings;
+};
@@ -0,0 +1,63 @@
+#pragma once
+
+//---------------------------------------------------------------------
+//---------------------------------------------------------------------
+#include <complex>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "sideband_waveform.h"
+
+//---------------------------------------------------------------------
+// nidevice NIPackedComplexNumber, NIPackedComplexNumberF32 and
+// NIPackedComplexI16 hold complex samples as interleaved little endian
+// real, imaginary pairs in one bytes field, instead of one nested
+// message per sample.  std::complex<T> is laid out as T[2], so double
+// and float payloads are read in place as std::complex spans.  I16
+// payloads are scaled to std::complex<float> with ScaleSidebandIQ.
+//---------------------------------------------------------------------
+template <class T>
+class SidebandComplexView
+{
+public:
+    explicit SidebandComplexView(const std::string& interleaved)
+        : _data(reinterpret_cast<const std::complex<T>*>(interleaved.data())), _count(interleaved.size() / sizeof(std::complex<T>))
+    {
+    }
+
+    inline const std::complex<T>* data() const { return _data; }
+    inline size_t size() const { return _count; }
+    inline const std::complex<T>* begin() const { return _data; }
+    inline const std::complex<T>* end() const { return _data + _count; }
+    inline const std::complex<T>& operator[](size_t index) const { return _data[index]; }
+
+private:
+    const std::complex<T>* _data;
+    size_t _count;
+};
+
+//---------------------------------------------------------------------
+//---------------------------------------------------------------------
+template <class T>
+inline void SetSidebandComplex(std::string* interleaved, const std::complex<T>* values, size_t count)
+{
+    interleaved->assign(reinterpret_cast<const char*>(values), count * sizeof(std::complex<T>));
+}
+
+//---------------------------------------------------------------------
+//---------------------------------------------------------------------
+inline void SetSidebandComplexI16(std::string* interleaved, const int16_t* pairs, size_t count)
+{
+    interleaved->assign(reinterpret_cast<const char*>(pairs), count * 2 * sizeof(int16_t));
+}
+
+//---------------------------------------------------------------------
+// Unscaled int16 pairs widened to std::complex<float>.
+//---------------------------------------------------------------------
+inline std::vector<std::complex<float>> DecodeSidebandComplexI16(const std::string& interleaved)
+{
+    std::vector<std::complex<float>> values(interleaved.size() / (2 * sizeof(int16_t)));
+    ScaleSidebandIQ(interleaved, 1.0, 0.0, values.data());
+    return values;
+}
@@ -0,0 +1,156 @@
+#pragma once
+
+//---------------------------------------------------------------------
+//---------------------------------------------------------------------
+#include <cstdint>
+#include <ostream>
+#include "sideband_grpc.h"
+
+//---------------------------------------------------------------------
+//---------------------------------------------------------------------
+struct SidebandControlLoopStats
+{
+    int64_t iterations;
+    // Iterations the driver reported late, see MarkLate.
+    int64_t lateIterations;
+    // Iterations whose measured period overran the sample period by more
+    // than the late tolerance.
+    int64_t overrunIterations;
+    int64_t periodNanoseconds;
+    int64_t minPeriodNanoseconds;
+    int64_t maxPeriodNanoseconds;
+    double meanPeriodNanoseconds;
+    int64_t jitterP50Nanoseconds;
+    int64_t jitterP99Nanoseconds;
+    int64_t jitterMaxNanoseconds;
+    int64_t callbackP99Nanoseconds;
+};
+
+//---------------------------------------------------------------------
+// Drives a hardware timed single point loop over one sideband stream.
+// Every tick writes the outputs computed on the previous tick, reads
+// the response of the read monikers (typically WaitForNextSampleClock
+// followed by the input read) and hands it to the callback to compute
+// the next outputs.
+//
+// Jitter is the distance of each measured tick period from the sample
+// period, so it includes the network and the server loop, not just the
+// hardware clock.
+//---------------------------------------------------------------------
+class SidebandControlLoop
+{
+public:
+    SidebandControlLoop(double sampleRate, double lateTolerance = 0.5)
+        : _periodNanoseconds((int64_t)(1000000000.0 / sampleRate)),
+        _lateTolerance(lateTolerance),
+        _periods(10000000000, 3),
+        _jitter(10000000000, 3),
+        _callback(10000000000, 3),
+        _iterations(0),
+        _lateIterations(0),
+        _overrunIterations(0)
+    {
+    }
+
+    // Call from the callback when the wait moniker reports is_late.
+    inline void MarkLate()
+    {
+        ++_lateIterations;
+    }
+
+    // callback(const SidebandReadResponse& read, SidebandWriteRequest* write)
+    // returns false to stop the loop.  Returns the number of ticks run.
+    template <class Callback>
+    inline int64_t Run(int64_t dataToken, int64_t iterations, const ni::data_monikers::SidebandWriteRequest& firstWrite, Callback callback)
+    {
+        ni::data_monikers::SidebandWriteRequest write(firstWrite);
+        ni::data_monikers::SidebandReadResponse read;
+        int64_t lastTick = 0;
+        int64_t x = 0;
+        for (; x < iterations; ++x)
+        {
+            read.Clear();
+            if (!WriteReadSidebandMessage(dataToken, write, &read) || read.cancel())
+            {
+                break;
+            }
+            auto tick = SidebandTimestampNanoseconds();
+            if (x > 0)
+            {
+                RecordPeriod(tick - lastTick);
+            }
+            lastTick = tick;
+            ++_iterations;
+
+            write.Clear();
+            bool keepRunning = callback(read, &write);
+            _callback.Record(SidebandTimestampNanoseconds() - tick);
+            if (!keepRunning)
+            {
+                ++x;
+                break;
+            }
+        }
+        return x;
+    }
+
+    inline SidebandControlLoopStats Stats() const
+    {
+        SidebandControlLoopStats stats = {};
+        stats.iterations = _iterations;
+        stats.lateIterations = _lateIterations;
+        stats.overrunIterations = _overrunIterations;
+        stats.periodNanoseconds = _periodNanoseconds;
+        if (_periods.TotalCount() > 0)
+        {
+            stats.minPeriodNanoseconds = _periods.Min();
+            stats.maxPeriodNanoseconds = _periods.Max();
+            stats.meanPeriodNanoseconds = _periods.Mean();
+            stats.jitterP50Nanoseconds = _jitter.ValueAtPercentile(50);
+            stats.jitterP99Nanoseconds = _jitter.ValueAtPercentile(99);
+            stats.jitterMaxNanoseconds = _jitter.Max();
+        }
+        if (_callback.TotalCount() > 0)
+        {
+            stats.callbackP99Nanoseconds = _callback.ValueAtPercentile(99);
+        }
+        return stats;
+    }
+
+    inline void WriteSummary(std::ostream& out) const
+    {
+        auto stats = Stats();
+        out << "  iterations " << stats.iterations
+            << ", late " << stats.lateIterations
+            << ", overrun " << stats.overrunIterations << std::endl;
+        out << "  period (us): target " << stats.periodNanoseconds / 1000.0
+            << ", min " << stats.minPeriodNanoseconds / 1000.0
+            << ", mean " << stats.meanPeriodNanoseconds / 1000.0
+            << ", max " << stats.maxPeriodNanoseconds / 1000.0 << std::endl;
+        out << "  jitter (us): p50 " << stats.jitterP50Nanoseconds / 1000.0
+            << ", p99 " << stats.jitterP99Nanoseconds / 1000.0
+            << ", max " << stats.jitterMaxNanoseconds / 1000.0
+            << ", callback p99 " << stats.callbackP99Nanoseconds / 1000.0 << std::endl;
+    }
+
+private:
+    inline void RecordPeriod(int64_t period)
+    {
+        _periods.Record(period);
+        _jitter.Record(period > _periodNanoseconds ? period - _periodNanoseconds : _periodNanoseconds - period);
+        if (period > _periodNanoseconds + (int64_t)(_periodNanoseconds * _lateTolerance))
+        {
+            ++_overrunIterations;
+        }
+    }
+
+private:
+    int64_t _periodNanoseconds;
+    double _lateTolerance;
+    HdrHistogram _periods;
+    HdrHistogram _jitter;
+    HdrHistogram _callback;
+    int64_t _iterations;
+    int64_t _lateIterations;
+    int64_t _overrunIterations;
+};
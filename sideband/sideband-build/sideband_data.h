@@ -39,7 +39,8 @@ enum class SidebandStrategy
   SOCKETS_LOW_LATENCY = 5,
   HYPERVISOR_SOCKETS = 6,
   RDMA = 7,
-  RDMA_LOW_LATENCY = 8
+  RDMA_LOW_LATENCY = 8,
+  SHARED_MEMORY_FANOUT = 9
 };
 
 //---------------------------------------------------------------------
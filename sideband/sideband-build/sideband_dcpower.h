@@ -0,0 +1,79 @@
+#pragma once
+
+//---------------------------------------------------------------------
+//---------------------------------------------------------------------
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include "sideband_burst.h"
+#include "sideband_fifo.h"
+
+//---------------------------------------------------------------------
+// One SMU measure record of a nidcpower MonikerFetchMultipleResponse.
+// The measurements bytes hold actual_count of these back to back, so a
+// record is read in place instead of from three parallel repeated
+// fields.  Assumes a little endian host.
+//---------------------------------------------------------------------
+struct SidebandDCPowerRecord
+{
+    double voltage;
+    double current;
+    uint8_t inCompliance;
+    uint8_t reserved[7];
+};
+
+static_assert(sizeof(SidebandDCPowerRecord) == 24, "SidebandDCPowerRecord must stay 24 bytes, it is the wire layout");
+
+//---------------------------------------------------------------------
+// Records of a measurements field, without copying them.
+//---------------------------------------------------------------------
+typedef SidebandFifoView<SidebandDCPowerRecord> SidebandDCPowerRecords;
+
+//---------------------------------------------------------------------
+// Fills the measurements field from the arrays niDCPower_FetchMultiple
+// returns.  Boolean is ViBoolean on the server.
+//
+// A BeginFetchMultiple server sizes each fetch with SidebandBurstSizer
+// from the FETCH_BACKLOG attribute, bounded by the minimum_count and
+// maximum_count of the request, and reports the remaining backlog with
+// every response.
+//---------------------------------------------------------------------
+template <class Boolean>
+inline void SetSidebandDCPowerRecords(std::string* measurements, const double* voltage, const double* current, const Boolean* inCompliance, size_t count)
+{
+    measurements->resize(count * sizeof(SidebandDCPowerRecord));
+    auto records = reinterpret_cast<SidebandDCPowerRecord*>(&(*measurements)[0]);
+    for (size_t x = 0; x < count; ++x)
+    {
+        records[x].voltage = voltage[x];
+        records[x].current = current[x];
+        records[x].inCompliance = inCompliance[x] ? 1 : 0;
+        std::memset(records[x].reserved, 0, sizeof(records[x].reserved));
+    }
+}
+
+//---------------------------------------------------------------------
+// Splits the records back into the parallel arrays FetchMultiple used to
+// return, any of which may be null.  Returns the number of records.
+//---------------------------------------------------------------------
+inline size_t GetSidebandDCPowerRecords(const std::string& measurements, double* voltage, double* current, bool* inCompliance)
+{
+    SidebandDCPowerRecords records(measurements);
+    for (size_t x = 0; x < records.size(); ++x)
+    {
+        if (voltage != nullptr)
+        {
+            voltage[x] = records[x].voltage;
+        }
+        if (current != nullptr)
+        {
+            current[x] = records[x].current;
+        }
+        if (inCompliance != nullptr)
+        {
+            inCompliance[x] = records[x].inCompliance != 0;
+        }
+    }
+    return records.size();
+}
@@ -0,0 +1,208 @@
+#pragma once
+
+//---------------------------------------------------------------------
+//---------------------------------------------------------------------
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "sideband_fifo.h"
+
+//---------------------------------------------------------------------
+// A nidigitalpattern MonikerFetchHistoryRAMResponse holds a block of
+// History RAM samples in columns instead of one message per cycle:
+//
+//   pattern_index, time_set_index, num_dut_cycles   int32 per sample
+//   vector_number, cycle_number                     int64 per sample
+//   expected_pin_states, actual_pin_states,
+//   per_pin_pass_fail                               uint8 per pin and
+//                                                   DUT cycle
+//
+// The pin columns are pin major: the states of the first pin for every
+// DUT cycle of the block, then the second pin and so on, in pin_list
+// order.  Pin states are the raw PinState values.  A sample covers
+// num_dut_cycles DUT cycles, so a block has the sum of those rows.
+// Assumes a little endian host.
+//---------------------------------------------------------------------
+class SidebandHistoryRAMBuilder
+{
+public:
+    explicit SidebandHistoryRAMBuilder(int32_t pinCount)
+        : _pinCount(pinCount < 0 ? 0 : pinCount)
+    {
+    }
+
+    // Starts the next block.
+    inline void Clear()
+    {
+        _patternIndex.clear();
+        _timeSetIndex.clear();
+        _vectorNumber.clear();
+        _cycleNumber.clear();
+        _dutCycles.clear();
+        _expected.clear();
+        _actual.clear();
+        _passFail.clear();
+    }
+
+    // Adds a sample from niDigital_FetchHistoryRAMCycleInformation.
+    inline void AddSample(int32_t patternIndex, int32_t timeSetIndex, int64_t vectorNumber, int64_t cycleNumber, int32_t dutCycles)
+    {
+        _patternIndex.push_back(patternIndex);
+        _timeSetIndex.push_back(timeSetIndex);
+        _vectorNumber.push_back(vectorNumber);
+        _cycleNumber.push_back(cycleNumber);
+        _dutCycles.push_back(dutCycles);
+    }
+
+    // Adds one DUT cycle of the last sample, the pin arrays of
+    // niDigital_FetchHistoryRAMCyclePinData with pinCount entries each.
+    template <class Boolean>
+    inline void AddCycle(const uint8_t* expected, const uint8_t* actual, const Boolean* passFail)
+    {
+        _expected.insert(_expected.end(), expected, expected + _pinCount);
+        _actual.insert(_actual.end(), actual, actual + _pinCount);
+        for (int32_t pin = 0; pin < _pinCount; ++pin)
+        {
+            _passFail.push_back(passFail[pin] ? 1 : 0);
+        }
+    }
+
+    inline size_t SampleCount() const { return _dutCycles.size(); }
+
+    // Fills the block fields of a MonikerFetchHistoryRAMResponse,
+    // turning the pin rows into pin columns.
+    template <class Response>
+    inline void Fill(Response* response) const
+    {
+        response->set_sample_count((int32_t)_dutCycles.size());
+        response->set_pin_count(_pinCount);
+        SetSidebandFifoElements(response->mutable_pattern_index(), _patternIndex.data(), _patternIndex.size());
+        SetSidebandFifoElements(response->mutable_time_set_index(), _timeSetIndex.data(), _timeSetIndex.size());
+        SetSidebandFifoElements(response->mutable_vector_number(), _vectorNumber.data(), _vectorNumber.size());
+        SetSidebandFifoElements(response->mutable_cycle_number(), _cycleNumber.data(), _cycleNumber.size());
+        SetSidebandFifoElements(response->mutable_num_dut_cycles(), _dutCycles.data(), _dutCycles.size());
+        Transpose(_expected, response->mutable_expected_pin_states());
+        Transpose(_actual, response->mutable_actual_pin_states());
+        Transpose(_passFail, response->mutable_per_pin_pass_fail());
+    }
+
+private:
+    inline void Transpose(const std::vector<uint8_t>& rows, std::string* columns) const
+    {
+        auto cycles = _pinCount == 0 ? 0 : rows.size() / _pinCount;
+        columns->resize(rows.size());
+        for (size_t cycle = 0; cycle < cycles; ++cycle)
+        {
+            for (int32_t pin = 0; pin < _pinCount; ++pin)
+            {
+                (*columns)[pin * cycles + cycle] = (char)rows[cycle * _pinCount + pin];
+            }
+        }
+    }
+
+private:
+    int32_t _pinCount;
+    std::vector<int32_t> _patternIndex;
+    std::vector<int32_t> _timeSetIndex;
+    std::vector<int64_t> _vectorNumber;
+    std::vector<int64_t> _cycleNumber;
+    std::vector<int32_t> _dutCycles;
+    std::vector<uint8_t> _expected;
+    std::vector<uint8_t> _actual;
+    std::vector<uint8_t> _passFail;
+};
+
+//---------------------------------------------------------------------
+// Client view of a MonikerFetchHistoryRAMResponse block, read in place.
+// The response must outlive the view.
+//---------------------------------------------------------------------
+class SidebandHistoryRAMBlock
+{
+public:
+    template <class Response>
+    explicit SidebandHistoryRAMBlock(const Response& response)
+        : _firstSample(response.first_sample_index()),
+          _pinCount(response.pin_count()),
+          _patternIndex(response.pattern_index()),
+          _timeSetIndex(response.time_set_index()),
+          _vectorNumber(response.vector_number()),
+          _cycleNumber(response.cycle_number()),
+          _dutCycles(response.num_dut_cycles()),
+          _expected(response.expected_pin_states()),
+          _actual(response.actual_pin_states()),
+          _passFail(response.per_pin_pass_fail())
+    {
+        // A malformed block whose per sample columns differ in length is
+        // cut to the shortest, so every accessor below SampleCount() is
+        // in range.
+        _sampleCount = std::min({ _dutCycles.size(), _patternIndex.size(), _timeSetIndex.size(), _vectorNumber.size(), _cycleNumber.size() });
+        size_t rows = 0;
+        _firstRow.reserve(_sampleCount);
+        for (size_t sample = 0; sample < _sampleCount; ++sample)
+        {
+            _firstRow.push_back(rows);
+            rows += _dutCycles[sample] < 0 ? 0 : (size_t)_dutCycles[sample];
+        }
+        _rowCount = rows;
+    }
+
+    inline int64_t FirstSampleIndex() const { return _firstSample; }
+    inline size_t SampleCount() const { return _sampleCount; }
+    inline int32_t PinCount() const { return _pinCount; }
+
+    // DUT cycles in the block, the length of every pin column.
+    inline size_t RowCount() const { return _rowCount; }
+
+    inline int32_t PatternIndex(size_t sample) const { return _patternIndex[sample]; }
+    inline int32_t TimeSetIndex(size_t sample) const { return _timeSetIndex[sample]; }
+    inline int64_t VectorNumber(size_t sample) const { return _vectorNumber[sample]; }
+    inline int64_t CycleNumber(size_t sample) const { return _cycleNumber[sample]; }
+    inline int32_t DutCycles(size_t sample) const { return _dutCycles[sample]; }
+
+    // Row of the first DUT cycle of sample in the pin columns.
+    inline size_t FirstRow(size_t sample) const { return _firstRow[sample]; }
+
+    // Pin columns, RowCount() values each.
+    inline const uint8_t* ExpectedStates(int32_t pin) const { return Column(_expected, pin); }
+    inline const uint8_t* ActualStates(int32_t pin) const { return Column(_actual, pin); }
+    inline const uint8_t* PassFail(int32_t pin) const { return Column(_passFail, pin); }
+
+    // Number of failing DUT cycles of pin in the block.
+    inline size_t FailureCount(int32_t pin) const
+    {
+        auto column = PassFail(pin);
+        size_t failures = 0;
+        for (size_t row = 0; column != nullptr && row < _rowCount; ++row)
+        {
+            failures += column[row] == 0 ? 1 : 0;
+        }
+        return failures;
+    }
+
+private:
+    inline const uint8_t* Column(const SidebandFifoView<uint8_t>& columns, int32_t pin) const
+    {
+        if (pin < 0 || pin >= _pinCount || (size_t)(pin + 1) * _rowCount > columns.size())
+        {
+            return nullptr;
+        }
+        return columns.data() + (size_t)pin * _rowCount;
+    }
+
+private:
+    int64_t _firstSample;
+    int32_t _pinCount;
+    SidebandFifoView<int32_t> _patternIndex;
+    SidebandFifoView<int32_t> _timeSetIndex;
+    SidebandFifoView<int64_t> _vectorNumber;
+    SidebandFifoView<int64_t> _cycleNumber;
+    SidebandFifoView<int32_t> _dutCycles;
+    SidebandFifoView<uint8_t> _expected;
+    SidebandFifoView<uint8_t> _actual;
+    SidebandFifoView<uint8_t> _passFail;
+    std::vector<size_t> _firstRow;
+    size_t _sampleCount;
+    size_t _rowCount;
+};
@@ -0,0 +1,912 @@
+#pragma once
+
+//---------------------------------------------------------------------
+//---------------------------------------------------------------------
+#ifndef _WIN32
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
+
+//---------------------------------------------------------------------
+//---------------------------------------------------------------------
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <new>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include "sideband_buffer_pool.h"
+#include "sideband_cancel.h"
+#include "sideband_internal.h"
+#include "sideband_semaphore.h"
+
+//---------------------------------------------------------------------
+// What the producer does when a reader is so far behind that the next
+// frame would overwrite data it has not read yet.
+//---------------------------------------------------------------------
+enum class SidebandFanoutPolicy
+{
+    // Wait for the reader, the slowest reader paces the producer.
+    BLOCK = 0,
+    // Disconnect the reader, its next read returns a cancel frame.
+    DROP = 1,
+    // Skip the reader ahead to the oldest frame still in the ring and
+    // count the frames it lost.
+    LAG = 2
+};
+
+//---------------------------------------------------------------------
+// Shared memory layout of a fan-out ring:
+//
+//   SidebandFanoutHeader
+//   SidebandFanoutReaderSlot[maxReaders]
+//   ring of capacity bytes
+//
+// Each frame in the ring is a SidebandFanoutRecord followed by the
+// payload, padded to 8 bytes.  A frame never wraps, a record with
+// length WrapMarker sends readers back to the start of the ring.
+// Positions are byte counts since the ring was created, so head minus
+// cursor is how far a reader is behind.
+//---------------------------------------------------------------------
+#define SIDEBAND_FANOUT_MAGIC "SBFAN01"
+
+//---------------------------------------------------------------------
+//---------------------------------------------------------------------
+struct SidebandFanoutRecord
+{
+    static const uint32_t WrapMarker = UINT32_MAX;
+
+    uint32_t length;
+    uint32_t reserved;
+};
+
+//---------------------------------------------------------------------
+// lock is 0 when idle, ReaderLock while the reader has a frame checked
+// out and WriterLock while the producer drops or moves the reader.
+//---------------------------------------------------------------------
+struct SidebandFanoutReaderSlot
+{
+    enum State : uint32_t { Free = 0, Active = 1, Dropped = 2 };
+    static const uint32_t ReaderLock = 1;
+    static const uint32_t WriterLock = 2;
+
+    SidebandFanoutReaderSlot()
+        : state(Free), lock(0), waiting(0), cursor(0), lostFrames(0), dataReady(0, true)
+    {
+    }
+
+    std::atomic<uint32_t> state;
+    std::atomic<uint32_t> lock;
+    std::atomic<uint32_t> waiting;
+    std::atomic<uint64_t> cursor;
+    std::atomic<uint64_t> lostFrames;
+    SidebandFutexSemaphore dataReady;
+};
+
+//---------------------------------------------------------------------
+//---------------------------------------------------------------------
+struct SidebandFanoutHeader
+{
+    SidebandFanoutHeader(SidebandFanoutPolicy policy_, int32_t maxReaders_, int64_t capacity_, int64_t maxFrameSize_)
+        : policy((uint32_t)policy_), maxReaders(maxReaders_), capacity(capacity_), maxFrameSize(maxFrameSize_),
+        head(0), writerClosed(0), writerWaiting(0), spaceFreed(0, true)
+    {
+        std::memcpy(magic, SIDEBAND_FANOUT_MAGIC, sizeof(magic));
+    }
+
+    char magic[8];
+    uint32_t policy;
+    int32_t maxReaders;
+    int64_t capacity;
+    int64_t maxFrameSize;
+    std::atomic<uint64_t> head;
+    std::atomic<uint32_t> writerClosed;
+    std::atomic<uint32_t> writerWaiting;
+    SidebandFutexSemaphore spaceFreed;
+};
+
+//---------------------------------------------------------------------
+// Maps a fan-out ring.  The producer creates it, readers in this or
+// other processes open it by id.
+//---------------------------------------------------------------------
+class SidebandFanoutRing
+{
+public:
+    SidebandFanoutRing()
+        : _owner(false), _mapping(nullptr), _mappedSize(0), _header(nullptr), _slots(nullptr), _ring(nullptr)
+    {
+    }
+
+    SidebandFanoutRing(const SidebandFanoutRing&) = delete;
+    SidebandFanoutRing& operator=(const SidebandFanoutRing&) = delete;
+
+    ~SidebandFanoutRing()
+    {
+#ifndef _WIN32
+        if (_mapping != nullptr)
+        {
+            munmap(_mapping, (size_t)_mappedSize);
+        }
+        if (_owner)
+        {
+            shm_unlink(ShmName(_id).c_str());
+        }
+#endif
+    }
+
+    inline bool Create(const std::string& id, int64_t capacity, int32_t maxReaders, SidebandFanoutPolicy policy)
+    {
+#ifdef _WIN32
+        return false;
+#else
+        capacity = (capacity + 7) & ~(int64_t)7;
+        if (capacity < 4096 || maxReaders < 1)
+        {
+            return false;
+        }
+        auto fd = shm_open(ShmName(id).c_str(), O_CREAT | O_EXCL | O_RDWR, 0666);
+        if (fd < 0)
+        {
+            return false;
+        }
+        _id = id;
+        _owner = true;
+        _mappedSize = RingOffset(maxReaders) + capacity;
+        if (ftruncate(fd, _mappedSize) != 0 || !Map(fd))
+        {
+            close(fd);
+            return false;
+        }
+        close(fd);
+        _header = new (_mapping) SidebandFanoutHeader(policy, maxReaders, capacity, capacity / 2 - (int64_t)sizeof(SidebandFanoutRecord));
+        _slots = reinterpret_cast<SidebandFanoutReaderSlot*>(_mapping + sizeof(SidebandFanoutHeader));
+        for (int32_t x = 0; x < maxReaders; ++x)
+        {
+            new (&_slots[x]) SidebandFanoutReaderSlot();
+        }
+        _ring = _mapping + RingOffset(maxReaders);
+        return true;
+#endif
+    }
+
+    inline bool Open(const std::string& id)
+    {
+#ifdef _WIN32
+        return false;
+#else
+        auto fd = shm_open(ShmName(id).c_str(), O_RDWR, 0666);
+        if (fd < 0)
+        {
+            return false;
+        }
+        struct stat fileStat;
+        if (fstat(fd, &fileStat) != 0 || fileStat.st_size < (off_t)sizeof(SidebandFanoutHeader))
+        {
+            close(fd);
+            return false;
+        }
+        _id = id;
+        _mappedSize = fileStat.st_size;
+        if (!Map(fd))
+        {
+            close(fd);
+            return false;
+        }
+        close(fd);
+        _header = reinterpret_cast<SidebandFanoutHeader*>(_mapping);
+        if (std::memcmp(_header->magic, SIDEBAND_FANOUT_MAGIC, sizeof(_header->magic)) != 0
+            || RingOffset(_header->maxReaders) + _header->capacity != _mappedSize)
+        {
+            return false;
+        }
+        _slots = reinterpret_cast<SidebandFanoutReaderSlot*>(_mapping + sizeof(SidebandFanoutHeader));
+        _ring = _mapping + RingOffset(_header->maxReaders);
+        return true;
+#endif
+    }
+
+    inline bool IsMapped() const { return _header != nullptr; }
+    inline const std::string& Id() const { return _id; }
+    inline SidebandFanoutHeader& Header() { return *_header; }
+    inline SidebandFanoutReaderSlot& Slot(int32_t index) { return _slots[index]; }
+    inline uint8_t* At(uint64_t position) { return _ring + position % (uint64_t)_header->capacity; }
+
+    inline uint32_t RecordLength(uint64_t position)
+    {
+        SidebandFanoutRecord record;
+        std::memcpy(&record, At(position), sizeof(record));
+        return record.length;
+    }
+
+    // Position of the frame after the one at position.
+    inline uint64_t NextPosition(uint64_t position)
+    {
+        auto length = RecordLength(position);
+        if (length == SidebandFanoutRecord::WrapMarker)
+        {
+            return position + (uint64_t)_header->capacity - position % (uint64_t)_header->capacity;
+        }
+        return position + RecordSize(length);
+    }
+
+    inline static uint64_t RecordSize(int64_t byteCount)
+    {
+        return (sizeof(SidebandFanoutRecord) + byteCount + 7) & ~(uint64_t)7;
+    }
+
+private:
+    inline static std::string ShmName(const std::string& id)
+    {
+        return "/sideband_fanout_" + id;
+    }
+
+    inline static int64_t RingOffset(int32_t maxReaders)
+    {
+        auto offset = (int64_t)(sizeof(SidebandFanoutHeader) + maxReaders * sizeof(SidebandFanoutReaderSlot));
+        return (offset + 63) & ~(int64_t)63;
+    }
+
+#ifndef _WIN32
+    inline bool Map(int fd)
+    {
+        auto mapping = mmap(nullptr, (size_t)_mappedSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (mapping == MAP_FAILED)
+        {
+            return false;
+        }
+        _mapping = static_cast<uint8_t*>(mapping);
+        return true;
+    }
+#endif
+
+private:
+    std::string _id;
+    bool _owner;
+    uint8_t* _mapping;
+    int64_t _mappedSize;
+    SidebandFanoutHeader* _header;
+    SidebandFanoutReaderSlot* _slots;
+    uint8_t* _ring;
+};
+
+//---------------------------------------------------------------------
+// Producer end.  Every frame is written once, however many readers
+// follow the ring.
+//---------------------------------------------------------------------
+class FanoutWriterSidebandData : public SidebandData, public SidebandInterruptible
+{
+public:
+    FanoutWriterSidebandData()
+        : SidebandData(0), _head(0), _pending(0), _reserved(-1), _cancelled(false)
+    {
+    }
+
+    virtual ~FanoutWriterSidebandData()
+    {
+        if (!_ring.IsMapped())
+        {
+            return;
+        }
+        auto& header = _ring.Header();
+        header.writerClosed.store(1, std::memory_order_seq_cst);
+        for (int32_t x = 0; x < header.maxReaders; ++x)
+        {
+            _ring.Slot(x).dataReady.notify();
+        }
+    }
+
+    inline bool Create(const std::string& id, int64_t capacity, int32_t maxReaders, SidebandFanoutPolicy policy)
+    {
+        return _ring.Create(id, capacity, maxReaders, policy);
+    }
+
+    const std::string& UsageId() override
+    {
+        return _ring.Id();
+    }
+
+    bool Write(const uint8_t* bytes, int64_t byteCount) override
+    {
+        auto buffer = Reserve(byteCount);
+        if (buffer == nullptr)
+        {
+            return false;
+        }
+        std::memcpy(buffer, bytes, (size_t)byteCount);
+        return Commit(byteCount);
+    }
+
+    bool WriteLengthPrefixed(const uint8_t* bytes, int64_t byteCount) override
+    {
+        return Write(bytes, byteCount);
+    }
+
+    bool Read(uint8_t* bytes, int64_t bufferSize, int64_t* numBytesRead) override
+    {
+        return false;
+    }
+
+    bool ReadFromLengthPrefixed(uint8_t* bytes, int64_t bufferSize, int64_t* numBytesRead) override
+    {
+        return false;
+    }
+
+    int64_t ReadLengthPrefix() override
+    {
+        return -1;
+    }
+
+    bool SupportsDirectReadWrite() override
+    {
+        return true;
+    }
+
+    // The direct write buffer holds up to half the ring.  Without a size
+    // the whole of it is reserved, which makes the producer wait for
+    // readers to free half the ring before every frame; writers that know
+    // the frame size use BeginDirectWrite(byteCount).
+    uint8_t* BeginDirectWrite() override
+    {
+        return Reserve(_ring.Header().maxFrameSize);
+    }
+
+    // Reserves only byteCount, for BeginSidebandDirectWrite.
+    inline uint8_t* BeginDirectWrite(int64_t byteCount)
+    {
+        return Reserve(byteCount);
+    }
+
+    bool FinishDirectWrite(int64_t byteCount) override
+    {
+        return Commit(byteCount);
+    }
+
+    inline int64_t MaxFrameSize()
+    {
+        return _ring.Header().maxFrameSize;
+    }
+
+    // Releases a producer waiting on a slow reader under the BLOCK policy.
+    void Cancel() override
+    {
+        _cancelled.store(true, std::memory_order_seq_cst);
+        _ring.Header().spaceFreed.notify();
+    }
+
+private:
+    inline uint8_t* Reserve(int64_t byteCount)
+    {
+        auto& header = _ring.Header();
+        if (byteCount < 0 || byteCount > header.maxFrameSize || _cancelled.load(std::memory_order_acquire))
+        {
+            return nullptr;
+        }
+        auto capacity = (uint64_t)header.capacity;
+        auto start = _head;
+        auto padding = capacity - start % capacity < SidebandFanoutRing::RecordSize(byteCount) ? capacity - start % capacity : 0;
+        if (!MakeRoom(start + padding + SidebandFanoutRing::RecordSize(byteCount)))
+        {
+            return nullptr;
+        }
+        if (padding > 0)
+        {
+            SidebandFanoutRecord wrap = { SidebandFanoutRecord::WrapMarker, 0 };
+            std::memcpy(_ring.At(start), &wrap, sizeof(wrap));
+        }
+        _pending = start + padding;
+        _reserved = byteCount;
+        return _ring.At(_pending) + sizeof(SidebandFanoutRecord);
+    }
+
+    inline bool Commit(int64_t byteCount)
+    {
+        auto& header = _ring.Header();
+        if (byteCount < 0 || byteCount > _reserved)
+        {
+            return false;
+        }
+        _reserved = -1;
+        SidebandFanoutRecord record = { (uint32_t)byteCount, 0 };
+        std::memcpy(_ring.At(_pending), &record, sizeof(record));
+        _head = _pending + SidebandFanoutRing::RecordSize(byteCount);
+        header.head.store(_head, std::memory_order_seq_cst);
+        for (int32_t x = 0; x < header.maxReaders; ++x)
+        {
+            auto& slot = _ring.Slot(x);
+            if (slot.waiting.load(std::memory_order_seq_cst) != 0)
+            {
+                slot.dataReady.notify();
+            }
+        }
+        return true;
+    }
+
+    // Applies the policy to every reader that would be overrun once the
+    // ring holds everything up to end.  Fails only when cancelled.
+    inline bool MakeRoom(uint64_t end)
+    {
+        auto& header = _ring.Header();
+        auto capacity = (uint64_t)header.capacity;
+        for (int32_t x = 0; x < header.maxReaders; ++x)
+        {
+            auto& slot = _ring.Slot(x);
+            while (slot.state.load(std::memory_order_acquire) == SidebandFanoutReaderSlot::Active
+                && end - slot.cursor.load(std::memory_order_seq_cst) > capacity)
+            {
+                switch ((SidebandFanoutPolicy)header.policy)
+                {
+                case SidebandFanoutPolicy::BLOCK:
+                    if (_cancelled.load(std::memory_order_acquire))
+                    {
+                        return false;
+                    }
+                    header.writerWaiting.store(1, std::memory_order_seq_cst);
+                    if (slot.state.load(std::memory_order_seq_cst) == SidebandFanoutReaderSlot::Active
+                        && end - slot.cursor.load(std::memory_order_seq_cst) > capacity)
+                    {
+                        header.spaceFreed.wait_for(std::chrono::milliseconds(10));
+                    }
+                    header.writerWaiting.store(0, std::memory_order_relaxed);
+                    break;
+                case SidebandFanoutPolicy::DROP:
+                    LockReader(slot);
+                    slot.state.store(SidebandFanoutReaderSlot::Dropped, std::memory_order_release);
+                    slot.lock.store(0, std::memory_order_release);
+                    slot.dataReady.notify();
+                    break;
+                case SidebandFanoutPolicy::LAG:
+                    LockReader(slot);
+                    {
+                        auto cursor = slot.cursor.load(std::memory_order_relaxed);
+                        uint64_t lost = 0;
+                        while (end - cursor > capacity && cursor < _head)
+                        {
+                            if (_ring.RecordLength(cursor) != SidebandFanoutRecord::WrapMarker)
+                            {
+                                ++lost;
+                            }
+                            cursor = _ring.NextPosition(cursor);
+                        }
+                        slot.cursor.store(cursor, std::memory_order_release);
+                        slot.lostFrames.fetch_add(lost, std::memory_order_relaxed);
+                    }
+                    slot.lock.store(0, std::memory_order_release);
+                    break;
+                }
+            }
+        }
+        return true;
+    }
+
+    // A reader holds its lock only while it has one frame checked out.
+    inline static void LockReader(SidebandFanoutReaderSlot& slot)
+    {
+        uint32_t idle = 0;
+        while (!slot.lock.compare_exchange_weak(idle, SidebandFanoutReaderSlot::WriterLock, std::memory_order_acquire))
+        {
+            idle = 0;
+            std::this_thread::yield();
+        }
+    }
+
+private:
+    SidebandFanoutRing _ring;
+    uint64_t _head;
+    uint64_t _pending;
+    int64_t _reserved;
+    std::atomic<bool> _cancelled;
+};
+
+//---------------------------------------------------------------------
+// Reader end.  Joins the ring at the live position and follows it with
+// its own cursor.  Direct reads point into the ring; the producer does
+// not reuse that space until FinishDirectRead.
+//---------------------------------------------------------------------
+class FanoutReaderSidebandData : public SidebandData, public SidebandInterruptible
+{
+public:
+    FanoutReaderSidebandData()
+        : SidebandData(0), _slot(nullptr), _checkedOut(0), _cancelled(false)
+    {
+    }
+
+    virtual ~FanoutReaderSidebandData()
+    {
+        if (_slot != nullptr)
+        {
+            _slot->lock.store(0, std::memory_order_release);
+            _slot->state.store(SidebandFanoutReaderSlot::Free, std::memory_order_release);
+            WakeWriter();
+        }
+    }
+
+    inline bool Open(const std::string& id)
+    {
+        if (!_ring.Open(id))
+        {
+            return false;
+        }
+        auto& header = _ring.Header();
+        for (int32_t x = 0; x < header.maxReaders; ++x)
+        {
+            auto& slot = _ring.Slot(x);
+            uint32_t free = SidebandFanoutReaderSlot::Free;
+            // Claimed slots stay Dropped, which the producer skips, until
+            // the cursor is set.
+            if (slot.state.compare_exchange_strong(free, SidebandFanoutReaderSlot::Dropped, std::memory_order_acq_rel))
+            {
+                slot.lock.store(0, std::memory_order_relaxed);
+                slot.cursor.store(header.head.load(std::memory_order_seq_cst), std::memory_order_seq_cst);
+                slot.lostFrames.store(0, std::memory_order_relaxed);
+                slot.state.store(SidebandFanoutReaderSlot::Active, std::memory_order_seq_cst);
+                _slot = &slot;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    inline int64_t LostFrames() const
+    {
+        return _slot == nullptr ? 0 : (int64_t)_slot->lostFrames.load(std::memory_order_relaxed);
+    }
+
+    const std::string& UsageId() override
+    {
+        return _ring.Id();
+    }
+
+    bool Write(const uint8_t* bytes, int64_t byteCount) override
+    {
+        return false;
+    }
+
+    bool WriteLengthPrefixed(const uint8_t* bytes, int64_t byteCount) override
+    {
+        return false;
+    }
+
+    // Fails on a frame larger than bufferSize and leaves it in the ring,
+    // so it can be sized with ReadLengthPrefix and read again.
+    bool Read(uint8_t* bytes, int64_t bufferSize, int64_t* numBytesRead) override
+    {
+        int64_t frameSize = 0;
+        auto frame = BeginDirectReadLengthPrefixed(&frameSize);
+        *numBytesRead = 0;
+        if (frameSize > bufferSize)
+        {
+            ReleaseFrame();
+            return false;
+        }
+        std::memcpy(bytes, frame, (size_t)frameSize);
+        *numBytesRead = frameSize;
+        return FinishDirectRead();
+    }
+
+    bool ReadFromLengthPrefixed(uint8_t* bytes, int64_t bufferSize, int64_t* numBytesRead) override
+    {
+        return Read(bytes, bufferSize, numBytesRead);
+    }
+
+    int64_t ReadLengthPrefix() override
+    {
+        int64_t frameSize = 0;
+        BeginDirectReadLengthPrefixed(&frameSize);
+        ReleaseFrame();
+        return frameSize;
+    }
+
+    bool SupportsDirectReadWrite() override
+    {
+        return true;
+    }
+
+    const uint8_t* BeginDirectRead(int64_t byteCount) override
+    {
+        int64_t frameSize = 0;
+        return BeginDirectReadLengthPrefixed(&frameSize);
+    }
+
+    // Returns a cancel frame once the reader is dropped, cancelled or the
+    // producer has gone away.
+    const uint8_t* BeginDirectReadLengthPrefixed(int64_t* bufferSize) override
+    {
+        static const uint8_t cancelFrame[] = { 0x08, 0x01 };
+        auto& header = _ring.Header();
+        while (_slot != nullptr && !_cancelled.load(std::memory_order_acquire))
+        {
+            Lock();
+            if (_slot->state.load(std::memory_order_acquire) != SidebandFanoutReaderSlot::Active)
+            {
+                Unlock();
+                break;
+            }
+            auto cursor = _slot->cursor.load(std::memory_order_relaxed);
+            if (cursor != header.head.load(std::memory_order_acquire))
+            {
+                auto length = _ring.RecordLength(cursor);
+                if (length != SidebandFanoutRecord::WrapMarker)
+                {
+                    _checkedOut = _ring.RecordSize(length);
+                    *bufferSize = length;
+                    return _ring.At(cursor) + sizeof(SidebandFanoutRecord);
+                }
+                _slot->cursor.store(_ring.NextPosition(cursor), std::memory_order_seq_cst);
+                Unlock();
+                continue;
+            }
+            Unlock();
+            if (header.writerClosed.load(std::memory_order_acquire) != 0)
+            {
+                break;
+            }
+            _slot->waiting.store(1, std::memory_order_seq_cst);
+            if (IsIdle())
+            {
+                _slot->dataReady.wait();
+            }
+            _slot->waiting.store(0, std::memory_order_relaxed);
+        }
+        _checkedOut = 0;
+        *bufferSize = sizeof(cancelFrame);
+        return cancelFrame;
+    }
+
+    bool FinishDirectRead() override
+    {
+        if (_checkedOut > 0)
+        {
+            _slot->cursor.fetch_add(_checkedOut, std::memory_order_seq_cst);
+            _checkedOut = 0;
+            Unlock();
+            WakeWriter();
+        }
+        return true;
+    }
+
+    // Ready also covers a dropped reader or a closed producer, the read
+    // that follows returns the cancel frame.
+    int32_t WaitForData(int64_t timeoutMicroseconds) override
+    {
+        if (_slot == nullptr)
+        {
+            return -1;
+        }
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::microseconds(timeoutMicroseconds);
+        while (!_cancelled.load(std::memory_order_acquire))
+        {
+            _slot->waiting.store(1, std::memory_order_seq_cst);
+            if (!IsIdle())
+            {
+                _slot->waiting.store(0, std::memory_order_relaxed);
+                return 0;
+            }
+            if (timeoutMicroseconds < 0)
+            {
+                _slot->dataReady.wait();
+            }
+            else
+            {
+                auto remaining = deadline - std::chrono::steady_clock::now();
+                if (remaining <= std::chrono::steady_clock::duration::zero() || !_slot->dataReady.wait_for(remaining))
+                {
+                    _slot->waiting.store(0, std::memory_order_relaxed);
+                    return IsIdle() ? SIDEBAND_TIMED_OUT : 0;
+                }
+            }
+            _slot->waiting.store(0, std::memory_order_relaxed);
+        }
+        return SIDEBAND_CANCELLED;
+    }
+
+    // Posts the futex the reader sleeps on.
+    void Cancel() override
+    {
+        _cancelled.store(true, std::memory_order_seq_cst);
+        if (_slot != nullptr)
+        {
+            _slot->dataReady.notify();
+        }
+    }
+
+private:
+    // True while there is nothing to read and nothing to report.
+    inline bool IsIdle()
+    {
+        auto& header = _ring.Header();
+        return header.head.load(std::memory_order_seq_cst) == _slot->cursor.load(std::memory_order_seq_cst)
+            && _slot->state.load(std::memory_order_seq_cst) == SidebandFanoutReaderSlot::Active
+            && header.writerClosed.load(std::memory_order_seq_cst) == 0;
+    }
+
+    inline void Lock()
+    {
+        uint32_t idle = 0;
+        while (!_slot->lock.compare_exchange_weak(idle, SidebandFanoutReaderSlot::ReaderLock, std::memory_order_acquire))
+        {
+            idle = 0;
+            std::this_thread::yield();
+        }
+    }
+
+    inline void Unlock()
+    {
+        _slot->lock.store(0, std::memory_order_release);
+    }
+
+    inline void WakeWriter()
+    {
+        if (_ring.Header().writerWaiting.load(std::memory_order_seq_cst) != 0)
+        {
+            _ring.Header().spaceFreed.notify();
+        }
+    }
+
+    // Gives back a checked out frame without consuming it.
+    inline void ReleaseFrame()
+    {
+        if (_checkedOut > 0)
+        {
+            _checkedOut = 0;
+            Unlock();
+        }
+    }
+
+private:
+    SidebandFanoutRing _ring;
+    SidebandFanoutReaderSlot* _slot;
+    uint64_t _checkedOut;
+    std::atomic<bool> _cancelled;
+};
+
+//---------------------------------------------------------------------
+// Tokens handed out for fan-out rings, so they can be told apart from
+// library tokens on close and when a call needs the ring itself.
+//---------------------------------------------------------------------
+class SidebandFanoutTokens
+{
+public:
+    static SidebandFanoutTokens& Instance()
+    {
+        static SidebandFanoutTokens tokens;
+        return tokens;
+    }
+
+    inline int64_t Add(FanoutWriterSidebandData* writer)
+    {
+        return Add(writer, writer, nullptr);
+    }
+
+    inline int64_t Add(FanoutReaderSidebandData* reader)
+    {
+        return Add(reader, nullptr, reader);
+    }
+
+    inline FanoutWriterSidebandData* FindWriter(int64_t dataToken)
+    {
+        if (_count.load(std::memory_order_relaxed) == 0)
+        {
+            return nullptr;
+        }
+        std::lock_guard<std::mutex> lock(_mutex);
+        auto it = _tokens.find(dataToken);
+        return it == _tokens.end() ? nullptr : it->second.writer;
+    }
+
+    inline FanoutReaderSidebandData* FindReader(int64_t dataToken)
+    {
+        if (_count.load(std::memory_order_relaxed) == 0)
+        {
+            return nullptr;
+        }
+        std::lock_guard<std::mutex> lock(_mutex);
+        auto it = _tokens.find(dataToken);
+        return it == _tokens.end() ? nullptr : it->second.reader;
+    }
+
+    inline bool Close(int64_t dataToken)
+    {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            if (_tokens.erase(dataToken) == 0)
+            {
+                return false;
+            }
+            _count.store((int64_t)_tokens.size(), std::memory_order_relaxed);
+        }
+        SidebandCancelTable::Instance().Remove(dataToken);
+        SidebandFrameLimits::Instance().Remove(dataToken);
+        delete reinterpret_cast<SidebandData*>(dataToken);
+        return true;
+    }
+
+private:
+    struct Entry
+    {
+        FanoutWriterSidebandData* writer;
+        FanoutReaderSidebandData* reader;
+    };
+
+    SidebandFanoutTokens()
+        : _count(0)
+    {
+    }
+
+    inline int64_t Add(SidebandData* sidebandData, FanoutWriterSidebandData* writer, FanoutReaderSidebandData* reader)
+    {
+        auto token = reinterpret_cast<int64_t>(sidebandData);
+        std::lock_guard<std::mutex> lock(_mutex);
+        _tokens[token] = Entry { writer, reader };
+        _count.store((int64_t)_tokens.size(), std::memory_order_relaxed);
+        return token;
+    }
+
+private:
+    std::mutex _mutex;
+    std::atomic<int64_t> _count;
+    std::unordered_map<int64_t, Entry> _tokens;
+};
+
+//---------------------------------------------------------------------
+// Creates the ring a read moniker publishes into.  Returns 0 on failure.
+//---------------------------------------------------------------------
+inline int64_t InitFanoutOwnerSidebandData(const std::string& id, int64_t capacity, int32_t maxReaders, SidebandFanoutPolicy policy)
+{
+    auto writer = new FanoutWriterSidebandData();
+    if (!writer->Create(id, capacity, maxReaders, policy))
+    {
+        delete writer;
+        return 0;
+    }
+    auto token = SidebandFanoutTokens::Instance().Add(writer);
+    SidebandCancelTable::Instance().AddInterruptible(token, writer);
+    SidebandFrameLimits::Instance().Set(token, writer->MaxFrameSize());
+    return token;
+}
+
+//---------------------------------------------------------------------
+// Joins a ring as one more reader.  Returns 0 if the ring does not exist
+// or all reader slots are taken.
+//---------------------------------------------------------------------
+inline int64_t InitFanoutClientSidebandData(const std::string& id)
+{
+    auto reader = new FanoutReaderSidebandData();
+    if (!reader->Open(id))
+    {
+        delete reader;
+        return 0;
+    }
+    auto token = SidebandFanoutTokens::Instance().Add(reader);
+    SidebandCancelTable::Instance().AddInterruptible(token, reader);
+    return token;
+}
+
+//---------------------------------------------------------------------
+//---------------------------------------------------------------------
+inline int64_t GetFanoutLostFrames(int64_t dataToken)
+{
+    auto reader = SidebandFanoutTokens::Instance().FindReader(dataToken);
+    return reader == nullptr ? 0 : reader->LostFrames();
+}
+
+//---------------------------------------------------------------------
+// SidebandData_BeginDirectWrite for a frame of byteCount bytes.  A
+// fan-out producer reserves only the frame in the ring, so small frames
+// do not wait for readers to free space they never use; other tokens
+// hand out their whole direct write buffer.
+//---------------------------------------------------------------------
+inline int32_t BeginSidebandDirectWrite(int64_t dataToken, int64_t byteCount, uint8_t** buffer)
+{
+    auto writer = SidebandFanoutTokens::Instance().FindWriter(dataToken);
+    if (writer == nullptr)
+    {
+        return SidebandData_BeginDirectWrite(dataToken, buffer);
+    }
+    *buffer = writer->BeginDirectWrite(byteCount);
+    return *buffer == nullptr ? -1 : 0;
+}
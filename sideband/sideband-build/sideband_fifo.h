@@ -0,0 +1,216 @@
+#pragma once
+
+//---------------------------------------------------------------------
+//---------------------------------------------------------------------
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include "sideband_grpc.h"
+
+//---------------------------------------------------------------------
+// DMA FIFO monikers (nifpga BeginReadFifoXX / BeginWriteFifoXX) carry
+// the elements as raw little endian bytes rather than repeated fields,
+// so a FIFO region can be moved with a single memcpy.
+//
+// On the server a read moniker acquires a region with
+// NiFpga_AcquireFifoReadElements, hands it to WriteSidebandFifoElements,
+// which encodes the whole SidebandReadResponse around it directly in the
+// sideband write buffer, and then releases the region.  The elements are
+// copied once, from the DMA buffer into the sideband buffer, and never
+// pass through a protobuf message.
+//---------------------------------------------------------------------
+class SidebandFifoFrame
+{
+public:
+    // Size of the SidebandReadResponse frame for one FIFO read response.
+    inline static int64_t FrameSize(const std::string& typeUrl, int32_t status, int64_t byteCount, uint32_t elementsRemaining)
+    {
+        auto any = AnySize(typeUrl, InnerSize(status, byteCount, elementsRemaining));
+        auto values = 1 + VarintSize(any) + any;
+        return 1 + VarintSize(values) + values;
+    }
+
+    // Writes the frame to buffer, which must hold FrameSize bytes.
+    // Returns the number of bytes written.
+    inline static int64_t Encode(uint8_t* buffer, const std::string& typeUrl, int32_t status, const void* elements, int64_t byteCount, uint32_t elementsRemaining)
+    {
+        auto inner = InnerSize(status, byteCount, elementsRemaining);
+        auto any = AnySize(typeUrl, inner);
+        auto values = 1 + VarintSize(any) + any;
+        auto out = buffer;
+        // SidebandReadResponse.values
+        *out++ = 0x12;
+        out = WriteVarint(out, values);
+        // MonikerValues.values
+        *out++ = 0x0A;
+        out = WriteVarint(out, any);
+        // Any.type_url
+        *out++ = 0x0A;
+        out = WriteVarint(out, typeUrl.size());
+        std::memcpy(out, typeUrl.data(), typeUrl.size());
+        out += typeUrl.size();
+        // Any.value
+        if (inner > 0)
+        {
+            *out++ = 0x12;
+            out = WriteVarint(out, inner);
+        }
+        if (status != 0)
+        {
+            *out++ = 0x08;
+            out = WriteVarint(out, (uint64_t)(int64_t)status);
+        }
+        if (byteCount > 0)
+        {
+            *out++ = 0x12;
+            out = WriteVarint(out, byteCount);
+            std::memcpy(out, elements, (size_t)byteCount);
+            out += byteCount;
+        }
+        if (elementsRemaining != 0)
+        {
+            *out++ = 0x18;
+            out = WriteVarint(out, elementsRemaining);
+        }
+        return out - buffer;
+    }
+
+    inline static int64_t VarintSize(uint64_t value)
+    {
+        int64_t size = 1;
+        while (value >= 0x80)
+        {
+            value >>= 7;
+            ++size;
+        }
+        return size;
+    }
+
+    inline static uint8_t* WriteVarint(uint8_t* out, uint64_t value)
+    {
+        while (value >= 0x80)
+        {
+            *out++ = (uint8_t)(value | 0x80);
+            value >>= 7;
+        }
+        *out++ = (uint8_t)value;
+        return out;
+    }
+
+private:
+    // MonikerReadFifoXXResponse, proto3 leaves out default values.
+    inline static int64_t InnerSize(int32_t status, int64_t byteCount, uint32_t elementsRemaining)
+    {
+        int64_t size = 0;
+        if (status != 0)
+        {
+            size += 1 + VarintSize((uint64_t)(int64_t)status);
+        }
+        if (byteCount > 0)
+        {
+            size += 1 + VarintSize(byteCount) + byteCount;
+        }
+        if (elementsRemaining != 0)
+        {
+            size += 1 + VarintSize(elementsRemaining);
+        }
+        return size;
+    }
+
+    inline static int64_t AnySize(const std::string& typeUrl, int64_t inner)
+    {
+        auto size = 1 + VarintSize(typeUrl.size()) + (int64_t)typeUrl.size();
+        return inner > 0 ? size + 1 + VarintSize(inner) + inner : size;
+    }
+};
+
+//---------------------------------------------------------------------
+// Sends one FIFO read response for the read moniker of a stream that has
+// no other read monikers.  typeUrl is the Any type of the response, for
+// example "type.googleapis.com/nifpga_grpc.MonikerReadFifoI16Response".
+// The frame is encoded in the direct write buffer only when it fits the
+// stream's registered buffer size; otherwise it goes out length prefixed
+// from a pooled buffer.  Returns the frame size or -1, also when the
+// frame is larger than the buffer of a direct transport.
+//---------------------------------------------------------------------
+inline int64_t WriteSidebandFifoElements(int64_t dataToken, const std::string& typeUrl, int32_t status, const void* elements, int64_t byteCount, uint32_t elementsRemaining)
+{
+    auto frameSize = SidebandFifoFrame::FrameSize(typeUrl, status, byteCount, elementsRemaining);
+    auto stats = SidebandStatsRegistry::Instance().Find(dataToken, true);
+    auto codec = SidebandCodecTable::Instance().Get(dataToken);
+    auto path = ChooseSidebandWritePath(dataToken, frameSize);
+    if (codec.codec == SidebandCodec::NONE && path == SidebandWritePath::TOO_LARGE)
+    {
+        RecordSidebandError(stats, -1);
+        return -1;
+    }
+    bool direct = codec.codec == SidebandCodec::NONE && path == SidebandWritePath::DIRECT;
+    auto start = std::chrono::steady_clock::now();
+    int32_t result = 0;
+    int64_t written = frameSize;
+    if (direct)
+    {
+        uint8_t* buffer = nullptr;
+        result = BeginSidebandDirectWrite(dataToken, frameSize, &buffer);
+        RecordSidebandError(stats, result);
+        if (result != 0)
+        {
+            return -1;
+        }
+        SidebandFifoFrame::Encode(buffer, typeUrl, status, elements, byteCount, elementsRemaining);
+        result = SidebandData_FinishDirectWrite(dataToken, frameSize);
+    }
+    else
+    {
+        auto frame = SidebandBufferPool::Instance().Acquire(frameSize);
+        SidebandFifoFrame::Encode(frame.Data(), typeUrl, status, elements, byteCount, elementsRemaining);
+        if (codec.codec != SidebandCodec::NONE)
+        {
+            auto block = EncodeSidebandBlock(codec, frame.Data(), frameSize, &written, stats);
+            result = SendSidebandFrame(dataToken, block.Data(), written, &direct);
+        }
+        else
+        {
+            result = SidebandData_WriteLengthPrefixed(dataToken, frame.Data(), frameSize);
+        }
+    }
+    RecordSidebandError(stats, result);
+    if (stats != nullptr)
+    {
+        stats->RecordWrite(written, direct, SidebandElapsedNanoseconds(start));
+    }
+    return result == 0 ? frameSize : -1;
+}
+
+//---------------------------------------------------------------------
+// Typed view of the data bytes of a FIFO moniker message, without
+// copying them out of the message.  Assumes a little endian host.
+//---------------------------------------------------------------------
+template <class T>
+class SidebandFifoView
+{
+public:
+    explicit SidebandFifoView(const std::string& data)
+        : _data(reinterpret_cast<const T*>(data.data())), _count(data.size() / sizeof(T))
+    {
+    }
+
+    inline const T* data() const { return _data; }
+    inline size_t size() const { return _count; }
+    inline const T* begin() const { return _data; }
+    inline const T* end() const { return _data + _count; }
+    inline const T& operator[](size_t index) const { return _data[index]; }
+
+private:
+    const T* _data;
+    size_t _count;
+};
+
+//---------------------------------------------------------------------
+// Fills the data field of a MonikerWriteFifoXXRequest.
+//---------------------------------------------------------------------
+template <class T>
+inline void SetSidebandFifoElements(std::string* data, const T* elements, size_t count)
+{
+    data->assign(reinterpret_cast<const char*>(elements), count * sizeof(T));
+}
@@ -5,74 +5,494 @@
 #pragma warning(disable : 4244)
 #pragma warning(disable : 4267)
 
+#include <chrono>
 #include <cstdint>
+#include <cstring>
+#include <string>
 #include <data_moniker.pb.h>
 #include "sideband_data.h"
 #include "sideband_internal.h"
+#include "sideband_cancel.h"
+#include "sideband_socket_client.h"
+#include "sideband_stats.h"
+#include "sideband_latency.h"
+#include "sideband_buffer_pool.h"
+#include "sideband_codec.h"
+#include "sideband_bitpack.h"
+#include "sideband_recorder.h"
+#include "sideband_replay.h"
+#include "sideband_fanout.h"
+#include "sideband_threading.h"
 
 //---------------------------------------------------------------------
+// Registers the codec and buffer size of a new client token.  Stats left
+// behind by an earlier token at the same address are dropped.
 //---------------------------------------------------------------------
-inline int64_t InitMonikerSidebandData(const ni::data_monikers::BeginMonikerSidebandStreamResponse& initResponse)
+inline int64_t RegisterClientSidebandData(int64_t token, const ni::data_monikers::BeginMonikerSidebandStreamResponse& response)
 {
-    int64_t token;
-    InitClientSidebandData(initResponse.connection_url().c_str(), (::SidebandStrategy)initResponse.strategy(), initResponse.sideband_identifier().c_str(), initResponse.buffer_size(), &token);
+    SidebandStatsRegistry::Instance().Remove(token);
+    SidebandCodecTable::Instance().Set(token, (SidebandCodec)response.codec());
+    SidebandFrameLimits::Instance().Set(token, response.buffer_size());
     return token;
 }
 
 //---------------------------------------------------------------------
+// Returns 0 if the stream could not be joined.
 //---------------------------------------------------------------------
 inline int64_t InitClientSidebandData(const ni::data_monikers::BeginMonikerSidebandStreamResponse& response)
 {
-    int64_t token;
-    InitClientSidebandData(response.connection_url().c_str(), (::SidebandStrategy)response.strategy(), response.sideband_identifier().c_str(), response.buffer_size(), &token);
+    int64_t token = 0;
+    auto strategy = (::SidebandStrategy)response.strategy();
+    if (strategy == ::SidebandStrategy::SHARED_MEMORY_FANOUT)
+    {
+        token = InitFanoutClientSidebandData(response.sideband_identifier());
+    }
+    else if (InitClientSidebandData(response.connection_url().c_str(), strategy, response.sideband_identifier().c_str(), response.buffer_size(), &token) != 0)
+    {
+        token = 0;
+    }
+    return token == 0 ? 0 : RegisterClientSidebandData(token, response);
+}
+
+//---------------------------------------------------------------------
+// InitClientSidebandData that connects socket streams itself instead of
+// through the sideband library, so SidebandData_Cancel and the timed
+// reads work on them; the other strategies are joined as usual.  Close
+// the token with CloseClientSidebandData.  Returns 0 on failure.
+//---------------------------------------------------------------------
+inline int64_t InitCancellableClientSidebandData(const ni::data_monikers::BeginMonikerSidebandStreamResponse& response)
+{
+    auto strategy = (::SidebandStrategy)response.strategy();
+    if (strategy != ::SidebandStrategy::SOCKETS && strategy != ::SidebandStrategy::SOCKETS_LOW_LATENCY)
+    {
+        return InitClientSidebandData(response);
+    }
+    int64_t token = 0;
+    if (!SidebandClientSockets::Instance().Connect(response.connection_url(), response.sideband_identifier(), response.buffer_size(), strategy == ::SidebandStrategy::SOCKETS_LOW_LATENCY, &token))
+    {
+        return 0;
+    }
+    return RegisterClientSidebandData(token, response);
+}
+
+//---------------------------------------------------------------------
+// Server side lookup of the token of a stream created with
+// InitOwnerSidebandData(strategy, bufferSize, ...).  Registers bufferSize
+// so the helpers only write frames that fit into the direct write
+// buffer.  Returns 0 if there is no such stream.
+//---------------------------------------------------------------------
+inline int64_t GetOwnerSidebandDataToken(const std::string& usageId, int64_t bufferSize)
+{
+    int64_t token = 0;
+    if (GetOwnerSidebandDataToken(usageId.c_str(), &token) != 0)
+    {
+        return 0;
+    }
+    SidebandStatsRegistry::Instance().Remove(token);
+    SidebandFrameLimits::Instance().Set(token, bufferSize);
+    return token;
+}
+
+//---------------------------------------------------------------------
+//---------------------------------------------------------------------
+inline int64_t InitMonikerSidebandData(const ni::data_monikers::BeginMonikerSidebandStreamResponse& initResponse)
+{
+    return InitClientSidebandData(initResponse);
+}
+
+//---------------------------------------------------------------------
+// Opens a recording as a client token that ReadSidebandMessage can read
+// like a live stream.  Returns 0 if the file is not a valid recording.
+//---------------------------------------------------------------------
+inline int64_t InitReplaySidebandData(const std::string& path, double speed)
+{
+    auto replay = ReplaySidebandData::InitNew(path, speed);
+    if (replay == nullptr)
+    {
+        return 0;
+    }
+    auto token = reinterpret_cast<int64_t>(replay);
+    SidebandStatsRegistry::Instance().Remove(token);
+    SidebandCodecTable::Instance().Set(token, replay->Codec().codec);
     return token;
 }
 
+//---------------------------------------------------------------------
+//---------------------------------------------------------------------
+inline int32_t CloseClientSidebandData(int64_t dataToken)
+{
+    SidebandStatsRegistry::Instance().Remove(dataToken);
+    SidebandCodecTable::Instance().Remove(dataToken);
+    SidebandFrameLimits::Instance().Remove(dataToken);
+    SidebandRecorderTable::Instance().Detach(dataToken);
+    if (SidebandClientSockets::Instance().Close(dataToken) || ReplaySidebandData::Close(dataToken) || SidebandFanoutTokens::Instance().Close(dataToken))
+    {
+        return 0;
+    }
+    return CloseSidebandData(dataToken);
+}
+
+//---------------------------------------------------------------------
+// Tees every frame read on dataToken into a new recording at path until
+// the token is closed.  The recorder must outlive the token.
+//---------------------------------------------------------------------
+inline bool StartSidebandRecording(int64_t dataToken, SidebandRecorder* recorder, const std::string& path)
+{
+    if (!recorder->Open(path, SidebandCodecTable::Instance().Get(dataToken)))
+    {
+        return false;
+    }
+    SidebandRecorderTable::Instance().Attach(dataToken, recorder);
+    return true;
+}
+
+//---------------------------------------------------------------------
+//---------------------------------------------------------------------
+inline int64_t SidebandElapsedNanoseconds(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+//---------------------------------------------------------------------
+//---------------------------------------------------------------------
+inline void RecordSidebandError(SidebandTokenStats* stats, int32_t result)
+{
+    if (result != 0 && stats != nullptr)
+    {
+        stats->RecordError(result, GetSocketError());
+    }
+}
+
+//---------------------------------------------------------------------
+// How a frame goes out on dataToken.  DIRECT: serialized in place in the
+// transport buffer, which the token's registered buffer size holds.
+// COPY: length prefixed from a pooled buffer, for transports without
+// direct writes and tokens whose buffer size is not known.  TOO_LARGE:
+// the frame exceeds the registered buffer of a direct transport; the
+// length prefixed write goes through the same buffer, so the frame
+// cannot be sent at all.
+//---------------------------------------------------------------------
+enum class SidebandWritePath
+{
+    DIRECT,
+    COPY,
+    TOO_LARGE
+};
+
+//---------------------------------------------------------------------
+//---------------------------------------------------------------------
+inline SidebandWritePath ChooseSidebandWritePath(int64_t dataToken, int64_t frameSize)
+{
+    if (SidebandData_SupportsDirectReadWrite(dataToken) != 1)
+    {
+        return SidebandWritePath::COPY;
+    }
+    auto& limits = SidebandFrameLimits::Instance();
+    if (limits.FitsDirectWrite(dataToken, frameSize))
+    {
+        return SidebandWritePath::DIRECT;
+    }
+    return limits.Get(dataToken) > 0 ? SidebandWritePath::TOO_LARGE : SidebandWritePath::COPY;
+}
+
+//---------------------------------------------------------------------
+// Compresses a serialized frame into a pooled buffer behind a
+// SidebandCodecHeader.  Frames larger than a reader accepts are not
+// encoded; blockSize is set to -1 and the lease is empty.
+//---------------------------------------------------------------------
+inline SidebandBufferPool::Lease EncodeSidebandBlock(const SidebandCodecSettings& settings, const uint8_t* serialized, int64_t byteSize, int64_t* blockSize, SidebandTokenStats* stats)
+{
+    if (byteSize < 0 || byteSize > SidebandFrameLimits::DefaultReadLimit)
+    {
+        *blockSize = -1;
+        return SidebandBufferPool::Lease();
+    }
+    auto start = std::chrono::steady_clock::now();
+    auto block = SidebandBufferPool::Instance().Acquire(sizeof(SidebandCodecHeader) + SidebandLz4::CompressBound(byteSize));
+    SidebandCodecHeader header = {};
+    header.codec = (uint8_t)settings.codec;
+    header.uncompressedSize = (uint32_t)byteSize;
+    std::memcpy(block.Data(), &header, sizeof(header));
+    *blockSize = sizeof(header) + SidebandLz4::Compress(serialized, byteSize, block.Data() + sizeof(header));
+    if (stats != nullptr)
+    {
+        stats->RecordCodec(byteSize, *blockSize, SidebandElapsedNanoseconds(start));
+    }
+    return block;
+}
+
+//---------------------------------------------------------------------
+// Sends a frame that is already encoded in memory, such as a block from
+// EncodeSidebandBlock.  It is copied into the direct write buffer when
+// ChooseSidebandWritePath allows it and written length prefixed
+// otherwise; a frame larger than the buffer of a direct transport, or a
+// frameSize < 0, is not sent.  direct is set to the path taken.  Returns
+// 0 or -1.
+//---------------------------------------------------------------------
+inline int32_t SendSidebandFrame(int64_t dataToken, const uint8_t* frame, int64_t frameSize, bool* direct)
+{
+    *direct = false;
+    auto path = frameSize < 0 ? SidebandWritePath::TOO_LARGE : ChooseSidebandWritePath(dataToken, frameSize);
+    if (path == SidebandWritePath::TOO_LARGE)
+    {
+        return -1;
+    }
+    if (path == SidebandWritePath::COPY)
+    {
+        return SidebandData_WriteLengthPrefixed(dataToken, frame, frameSize);
+    }
+    *direct = true;
+    uint8_t* buffer = nullptr;
+    if (BeginSidebandDirectWrite(dataToken, frameSize, &buffer) != 0)
+    {
+        return -1;
+    }
+    std::memcpy(buffer, frame, frameSize);
+    return SidebandData_FinishDirectWrite(dataToken, frameSize);
+}
+
+//---------------------------------------------------------------------
+// Undoes EncodeSidebandBlock into a pooled buffer.  Returns false if the
+// block is corrupt, uses an unknown codec or claims to expand past what
+// a reader accepts.
+//---------------------------------------------------------------------
+inline bool DecodeSidebandBlock(const uint8_t* buffer, int64_t bufferSize, SidebandBufferPool::Lease* decoded, int64_t* decodedSize, SidebandTokenStats* stats)
+{
+    SidebandCodecHeader header;
+    if (bufferSize < (int64_t)sizeof(header))
+    {
+        return false;
+    }
+    auto start = std::chrono::steady_clock::now();
+    std::memcpy(&header, buffer, sizeof(header));
+    if (header.codec != (uint8_t)SidebandCodec::LZ4 || header.uncompressedSize > SidebandFrameLimits::DefaultReadLimit)
+    {
+        return false;
+    }
+    *decoded = SidebandBufferPool::Instance().Acquire(header.uncompressedSize);
+    *decodedSize = SidebandLz4::Decompress(buffer + sizeof(header), bufferSize - sizeof(header), decoded->Data(), decoded->Capacity());
+    if (*decodedSize != header.uncompressedSize)
+    {
+        return false;
+    }
+    if (stats != nullptr)
+    {
+        stats->RecordCodec(*decodedSize, bufferSize, SidebandElapsedNanoseconds(start));
+    }
+    return true;
+}
+
+//---------------------------------------------------------------------
+//---------------------------------------------------------------------
+inline bool ParseSidebandPayload(const SidebandCodecSettings& settings, const uint8_t* buffer, int64_t bufferSize, google::protobuf::MessageLite* message, SidebandTokenStats* stats)
+{
+    if (settings.codec == SidebandCodec::NONE)
+    {
+        return message->ParseFromArray(buffer, bufferSize);
+    }
+    SidebandBufferPool::Lease decoded;
+    int64_t decodedSize = 0;
+    if (!DecodeSidebandBlock(buffer, bufferSize, &decoded, &decodedSize, stats))
+    {
+        return false;
+    }
+    return message->ParseFromArray(decoded.Data(), decodedSize);
+}
+
 //---------------------------------------------------------------------
 //---------------------------------------------------------------------
 inline bool ReadSidebandMessage(int64_t dataToken, google::protobuf::MessageLite* message)
 {
     bool success = false;
+    auto& latency = SidebandLatencyRecorder::Instance();
+    auto callStart = latency.Enabled() ? SidebandTimestampNanoseconds() : 0;
+    auto stats = SidebandStatsRegistry::Instance().Find(dataToken, true);
+    auto codec = SidebandCodecTable::Instance().Get(dataToken);
+    auto recorder = SidebandRecorderTable::Instance().Find(dataToken);
     if (SidebandData_SupportsDirectReadWrite(dataToken) == 1)
     {
         int64_t bufferSize = 0;
         const uint8_t* buffer = nullptr;
-        SidebandData_BeginDirectReadLengthPrefixed(dataToken, &bufferSize, &buffer);
-        success = message->ParseFromArray(buffer, bufferSize);
+        auto start = std::chrono::steady_clock::now();
+        auto result = SidebandData_BeginDirectReadLengthPrefixed(dataToken, &bufferSize, &buffer);
+        auto blocked = SidebandElapsedNanoseconds(start);
+        RecordSidebandError(stats, result);
+        if (recorder != nullptr && result == 0)
+        {
+            recorder->Append(buffer, bufferSize);
+        }
+        success = result == 0 && ParseSidebandPayload(codec, buffer, bufferSize, message, stats);
         SidebandData_FinishDirectRead(dataToken);
+        if (stats != nullptr)
+        {
+            stats->RecordRead(bufferSize, true, blocked);
+        }
     }
     else
     {
         int64_t bufferSize = 0;
-        SidebandData_ReadLengthPrefix(dataToken, &bufferSize);
+        auto start = std::chrono::steady_clock::now();
+        // Sockets the helpers connected are polled before the library
+        // blocks in recv, so SidebandData_Cancel wakes a reader waiting
+        // for the next frame.
+        auto cancel = SidebandCancelTable::Instance().Find(dataToken);
+        if (cancel != nullptr && cancel->hasSocket && SidebandData_WaitForData(dataToken, -1) != 0)
+        {
+            return false;
+        }
+        auto result = SidebandData_ReadLengthPrefix(dataToken, &bufferSize);
+        RecordSidebandError(stats, result);
+        // A corrupt length prefix must not turn into a huge allocation.
+        if (result != 0 || bufferSize < 0 || bufferSize > SidebandFrameLimits::Instance().ReadLimit(dataToken))
+        {
+            RecordSidebandError(stats, -1);
+            return false;
+        }
         int64_t bytesRead = 0;
-        uint8_t* buffer = nullptr;
-        SidebandData_SerializeBuffer(dataToken, &buffer);
-        SidebandData_ReadFromLengthPrefixed(dataToken, buffer, bufferSize, &bytesRead);
-        success = message->ParseFromArray(buffer, bufferSize);
-        assert(success);
+        bool allocated = false;
+        auto buffer = SidebandBufferPool::Instance().Acquire(bufferSize, &allocated);
+        if (allocated && stats != nullptr)
+        {
+            stats->RecordSerializeBufferGrowth();
+        }
+        result = SidebandData_ReadFromLengthPrefixed(dataToken, buffer.Data(), bufferSize, &bytesRead);
+        auto blocked = SidebandElapsedNanoseconds(start);
+        RecordSidebandError(stats, result);
+        if (recorder != nullptr && result == 0)
+        {
+            recorder->Append(buffer.Data(), bufferSize);
+        }
+        success = result == 0 && ParseSidebandPayload(codec, buffer.Data(), bufferSize, message, stats);
+        if (stats != nullptr)
+        {
+            stats->RecordRead(bufferSize, false, blocked);
+        }
+    }
+    if (latency.Enabled())
+    {
+        latency.Record(SidebandLatencyKind::READ, SidebandTimestampNanoseconds() - callStart);
     }
     return success;
 }
 
 //---------------------------------------------------------------------
+// Returns the serialized size of message, or -1 if it was not written.
 //---------------------------------------------------------------------
 inline int64_t WriteSidebandMessage(int64_t dataToken, const google::protobuf::MessageLite& message)
 {
+    auto& latency = SidebandLatencyRecorder::Instance();
+    auto callStart = latency.Enabled() ? SidebandTimestampNanoseconds() : 0;
     auto byteSize = message.ByteSizeLong();
-    if (SidebandData_SupportsDirectReadWrite(dataToken) == 1)
+    auto stats = SidebandStatsRegistry::Instance().Find(dataToken, true);
+    auto codec = SidebandCodecTable::Instance().Get(dataToken);
+    if (codec.codec != SidebandCodec::NONE)
+    {
+        auto serialized = SidebandBufferPool::Instance().Acquire(byteSize);
+        message.SerializeToArray(serialized.Data(), byteSize);
+        int64_t blockSize = 0;
+        auto block = EncodeSidebandBlock(codec, serialized.Data(), byteSize, &blockSize, stats);
+        bool direct = false;
+        auto start = std::chrono::steady_clock::now();
+        auto result = SendSidebandFrame(dataToken, block.Data(), blockSize, &direct);
+        RecordSidebandError(stats, result);
+        if (result != 0)
+        {
+            return -1;
+        }
+        if (stats != nullptr)
+        {
+            stats->RecordWrite(blockSize, direct, SidebandElapsedNanoseconds(start));
+        }
+    }
+    else if (SidebandData_SupportsDirectReadWrite(dataToken) == 1)
     {
+        // Tokens with no registered buffer size are written in place
+        // unchecked, as the library always has.
+        if (ChooseSidebandWritePath(dataToken, byteSize) == SidebandWritePath::TOO_LARGE)
+        {
+            RecordSidebandError(stats, -1);
+            return -1;
+        }
         uint8_t* buffer = nullptr;
-        SidebandData_BeginDirectWrite(dataToken, &buffer);
+        auto start = std::chrono::steady_clock::now();
+        auto result = BeginSidebandDirectWrite(dataToken, byteSize, &buffer);
+        RecordSidebandError(stats, result);
+        if (result != 0)
+        {
+            return -1;
+        }
         message.SerializeToArray(buffer, byteSize);
-        SidebandData_FinishDirectWrite(dataToken, byteSize);
+        result = SidebandData_FinishDirectWrite(dataToken, byteSize);
+        RecordSidebandError(stats, result);
+        if (stats != nullptr)
+        {
+            stats->RecordWrite(byteSize, true, SidebandElapsedNanoseconds(start));
+        }
+        if (result != 0)
+        {
+            return -1;
+        }
     }
     else
     {
-        uint8_t* buffer = nullptr;
-        SidebandData_SerializeBuffer(dataToken, &buffer);
-        message.SerializeToArray(buffer, byteSize);
-        SidebandData_WriteLengthPrefixed(dataToken, buffer, byteSize);
+        bool allocated = false;
+        auto buffer = SidebandBufferPool::Instance().Acquire(byteSize, &allocated);
+        if (allocated && stats != nullptr)
+        {
+            stats->RecordSerializeBufferGrowth();
+        }
+        message.SerializeToArray(buffer.Data(), byteSize);
+        auto start = std::chrono::steady_clock::now();
+        auto result = SidebandData_WriteLengthPrefixed(dataToken, buffer.Data(), byteSize);
+        RecordSidebandError(stats, result);
+        if (stats != nullptr)
+        {
+            stats->RecordWrite(byteSize, false, SidebandElapsedNanoseconds(start));
+        }
+        if (result != 0)
+        {
+            return -1;
+        }
+    }
+    if (latency.Enabled())
+    {
+        latency.Record(SidebandLatencyKind::WRITE, SidebandTimestampNanoseconds() - callStart);
     }
     return byteSize;
 }
+
+//---------------------------------------------------------------------
+// ReadSidebandMessage that gives up if no frame starts arriving within
+// timeoutMilliseconds; a frame that has started is read to the end.
+// Returns 0, -1, SIDEBAND_TIMED_OUT or SIDEBAND_CANCELLED, and
+// SIDEBAND_NOT_SUPPORTED for tokens the sideband library connected,
+// which cannot be waited on.
+//---------------------------------------------------------------------
+inline int32_t ReadSidebandMessageWithTimeout(int64_t dataToken, google::protobuf::MessageLite* message, int64_t timeoutMilliseconds)
+{
+    auto result = SidebandData_WaitForData(dataToken, timeoutMilliseconds);
+    if (result != 0)
+    {
+        return result;
+    }
+    if (!ReadSidebandMessage(dataToken, message))
+    {
+        return SidebandData_IsCancelled(dataToken) == 1 ? SIDEBAND_CANCELLED : -1;
+    }
+    return 0;
+}
+
+//---------------------------------------------------------------------
+// Returns false without reading if request could not be written.
+//---------------------------------------------------------------------
+inline bool WriteReadSidebandMessage(int64_t dataToken, const google::protobuf::MessageLite& request, google::protobuf::MessageLite* response)
+{
+    auto& latency = SidebandLatencyRecorder::Instance();
+    auto start = latency.Enabled() ? SidebandTimestampNanoseconds() : 0;
+    auto success = WriteSidebandMessage(dataToken, request) >= 0 && ReadSidebandMessage(dataToken, response);
+    if (latency.Enabled())
+    {
+        latency.Record(SidebandLatencyKind::ROUND_TRIP, SidebandTimestampNanoseconds() - start);
+    }
+    return success;
+}
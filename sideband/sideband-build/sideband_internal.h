@@ -215,3 +215,4 @@ std::string GetRdmaAddress();
 
 std::string GetSocketsAddress();
 std::string GetSocketsPort();
+int GetSocketError();
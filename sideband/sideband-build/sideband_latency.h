@@ -0,0 +1,506 @@
+#pragma once
+
+//---------------------------------------------------------------------
+//---------------------------------------------------------------------
+#ifdef _WIN32
+    #ifndef WIN32_LEAN_AND_MEAN
+        #define WIN32_LEAN_AND_MEAN
+    #endif
+    #include <windows.h>
+    #include <intrin.h>
+#else
+    #include <ctime>
+#endif
+
+//---------------------------------------------------------------------
+//---------------------------------------------------------------------
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <vector>
+
+//---------------------------------------------------------------------
+// Monotonic timestamp that is not slewed by NTP, in nanoseconds.
+//---------------------------------------------------------------------
+inline int64_t SidebandTimestampNanoseconds()
+{
+#ifdef _WIN32
+    static const int64_t frequency = []()
+    {
+        LARGE_INTEGER value;
+        QueryPerformanceFrequency(&value);
+        return (int64_t)value.QuadPart;
+    }();
+    LARGE_INTEGER now;
+    QueryPerformanceCounter(&now);
+    return (now.QuadPart / frequency) * 1000000000 + ((now.QuadPart % frequency) * 1000000000) / frequency;
+#else
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+    return (int64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+#endif
+}
+
+//---------------------------------------------------------------------
+// High dynamic range histogram with the HdrHistogram bucket layout:
+// every recorded value keeps significantFigures decimal digits of
+// precision from 1 up to highestTrackableValue.  Counts are atomics so
+// one thread can record while another merges or exports.
+//---------------------------------------------------------------------
+class HdrHistogram
+{
+public:
+    HdrHistogram(int64_t highestTrackableValue = 10000000000, int significantFigures = 2)
+        : _highestTrackableValue(std::max<int64_t>(highestTrackableValue, 2)),
+        _significantFigures(std::min(std::max(significantFigures, 1), 5)),
+        _totalCount(0)
+    {
+        int64_t largestValueWithSingleUnitResolution = 2;
+        for (int x = 0; x < _significantFigures; ++x)
+        {
+            largestValueWithSingleUnitResolution *= 10;
+        }
+        int subBucketCountMagnitude = (int)std::ceil(std::log2((double)largestValueWithSingleUnitResolution));
+        _subBucketHalfCountMagnitude = std::max(subBucketCountMagnitude, 1) - 1;
+        _subBucketCount = (int64_t)1 << (_subBucketHalfCountMagnitude + 1);
+        _subBucketHalfCount = _subBucketCount / 2;
+        _subBucketMask = _subBucketCount - 1;
+
+        int64_t smallestUntrackableValue = _subBucketCount;
+        int bucketsNeeded = 1;
+        while (smallestUntrackableValue <= _highestTrackableValue)
+        {
+            if (smallestUntrackableValue > INT64_MAX / 2)
+            {
+                ++bucketsNeeded;
+                break;
+            }
+            smallestUntrackableValue <<= 1;
+            ++bucketsNeeded;
+        }
+        _countsLength = (size_t)((bucketsNeeded + 1) * _subBucketHalfCount);
+        _counts.reset(new std::atomic<int64_t>[_countsLength]());
+    }
+
+    HdrHistogram(const HdrHistogram&) = delete;
+    HdrHistogram& operator=(const HdrHistogram&) = delete;
+
+    inline void Record(int64_t value, int64_t count = 1)
+    {
+        value = std::min(std::max<int64_t>(value, 0), _highestTrackableValue);
+        _counts[CountsIndex(value)].fetch_add(count, std::memory_order_relaxed);
+        _totalCount.fetch_add(count, std::memory_order_relaxed);
+    }
+
+    // other must have the same layout, which is the case for histograms
+    // built with the same range and precision.
+    inline bool Merge(const HdrHistogram& other)
+    {
+        if (other._countsLength != _countsLength || other._subBucketCount != _subBucketCount)
+        {
+            return false;
+        }
+        for (size_t x = 0; x < _countsLength; ++x)
+        {
+            auto count = other._counts[x].load(std::memory_order_relaxed);
+            if (count != 0)
+            {
+                _counts[x].fetch_add(count, std::memory_order_relaxed);
+                _totalCount.fetch_add(count, std::memory_order_relaxed);
+            }
+        }
+        return true;
+    }
+
+    inline void Reset()
+    {
+        for (size_t x = 0; x < _countsLength; ++x)
+        {
+            _counts[x].store(0, std::memory_order_relaxed);
+        }
+        _totalCount.store(0, std::memory_order_relaxed);
+    }
+
+    inline int64_t TotalCount() const
+    {
+        return _totalCount.load(std::memory_order_relaxed);
+    }
+
+    inline int64_t Min() const
+    {
+        for (size_t x = 0; x < _countsLength; ++x)
+        {
+            if (_counts[x].load(std::memory_order_relaxed) != 0)
+            {
+                return ValueFromIndex(x);
+            }
+        }
+        return 0;
+    }
+
+    inline int64_t Max() const
+    {
+        for (size_t x = _countsLength; x > 0; --x)
+        {
+            if (_counts[x - 1].load(std::memory_order_relaxed) != 0)
+            {
+                return HighestEquivalentValue(ValueFromIndex(x - 1));
+            }
+        }
+        return 0;
+    }
+
+    inline double Mean() const
+    {
+        double total = 0;
+        int64_t count = 0;
+        for (size_t x = 0; x < _countsLength; ++x)
+        {
+            auto bucketCount = _counts[x].load(std::memory_order_relaxed);
+            if (bucketCount != 0)
+            {
+                total += (double)MedianEquivalentValue(ValueFromIndex(x)) * bucketCount;
+                count += bucketCount;
+            }
+        }
+        return count == 0 ? 0.0 : total / count;
+    }
+
+    inline int64_t ValueAtPercentile(double percentile) const
+    {
+        percentile = std::min(std::max(percentile, 0.0), 100.0);
+        int64_t total = 0;
+        for (size_t x = 0; x < _countsLength; ++x)
+        {
+            total += _counts[x].load(std::memory_order_relaxed);
+        }
+        int64_t countAtPercentile = std::max<int64_t>((int64_t)std::ceil(percentile / 100.0 * total), 1);
+        int64_t cumulative = 0;
+        for (size_t x = 0; x < _countsLength; ++x)
+        {
+            cumulative += _counts[x].load(std::memory_order_relaxed);
+            if (cumulative >= countAtPercentile)
+            {
+                return HighestEquivalentValue(ValueFromIndex(x));
+            }
+        }
+        return 0;
+    }
+
+    // Layout parameters followed by the counts, zigzag varint encoded with
+    // runs of empty buckets stored as a single negative run length.
+    inline std::vector<uint8_t> Encode() const
+    {
+        std::vector<uint8_t> encoded = { 'S', 'H', 'D', 'R' };
+        WriteVarint(encoded, (uint64_t)_highestTrackableValue);
+        WriteVarint(encoded, (uint64_t)_significantFigures);
+        size_t x = 0;
+        while (x < _countsLength)
+        {
+            auto count = _counts[x].load(std::memory_order_relaxed);
+            if (count == 0)
+            {
+                int64_t zeros = 0;
+                while (x < _countsLength && _counts[x].load(std::memory_order_relaxed) == 0)
+                {
+                    ++zeros;
+                    ++x;
+                }
+                WriteVarint(encoded, ZigZag(-zeros));
+            }
+            else
+            {
+                WriteVarint(encoded, ZigZag(count));
+                ++x;
+            }
+        }
+        return encoded;
+    }
+
+    inline static std::unique_ptr<HdrHistogram> Decode(const uint8_t* bytes, size_t byteCount)
+    {
+        if (byteCount < 4 || bytes[0] != 'S' || bytes[1] != 'H' || bytes[2] != 'D' || bytes[3] != 'R')
+        {
+            return nullptr;
+        }
+        size_t position = 4;
+        uint64_t highestTrackableValue = 0;
+        uint64_t significantFigures = 0;
+        if (!ReadVarint(bytes, byteCount, &position, &highestTrackableValue) || !ReadVarint(bytes, byteCount, &position, &significantFigures))
+        {
+            return nullptr;
+        }
+        std::unique_ptr<HdrHistogram> histogram(new HdrHistogram((int64_t)highestTrackableValue, (int)significantFigures));
+        size_t x = 0;
+        uint64_t encodedValue = 0;
+        while (position < byteCount && ReadVarint(bytes, byteCount, &position, &encodedValue))
+        {
+            auto value = UnZigZag(encodedValue);
+            if (value < 0)
+            {
+                x += (size_t)-value;
+            }
+            else if (x < histogram->_countsLength)
+            {
+                histogram->_counts[x++].store(value, std::memory_order_relaxed);
+                histogram->_totalCount.fetch_add(value, std::memory_order_relaxed);
+            }
+        }
+        return histogram;
+    }
+
+    inline void WriteJson(std::ostream& out) const
+    {
+        out << "{\"totalCount\":" << TotalCount()
+            << ",\"min\":" << Min()
+            << ",\"max\":" << Max()
+            << ",\"mean\":" << Mean()
+            << ",\"percentiles\":{";
+        const double percentiles[] = { 50.0, 90.0, 99.0, 99.9, 99.99, 100.0 };
+        for (size_t x = 0; x < sizeof(percentiles) / sizeof(percentiles[0]); ++x)
+        {
+            out << (x == 0 ? "" : ",") << "\"" << percentiles[x] << "\":" << ValueAtPercentile(percentiles[x]);
+        }
+        out << "},\"counts\":[";
+        bool first = true;
+        for (size_t x = 0; x < _countsLength; ++x)
+        {
+            auto count = _counts[x].load(std::memory_order_relaxed);
+            if (count != 0)
+            {
+                out << (first ? "" : ",") << "[" << ValueFromIndex(x) << "," << count << "]";
+                first = false;
+            }
+        }
+        out << "]}";
+    }
+
+private:
+    inline static int CountLeadingZeros(uint64_t value)
+    {
+#ifdef _WIN32
+        unsigned long index;
+        return _BitScanReverse64(&index, value) ? 63 - (int)index : 64;
+#else
+        return value == 0 ? 64 : __builtin_clzll(value);
+#endif
+    }
+
+    inline int BucketIndex(int64_t value) const
+    {
+        int pow2Ceiling = 64 - CountLeadingZeros((uint64_t)(value | _subBucketMask));
+        return pow2Ceiling - (_subBucketHalfCountMagnitude + 1);
+    }
+
+    inline size_t CountsIndex(int64_t value) const
+    {
+        int bucketIndex = BucketIndex(value);
+        int64_t subBucketIndex = value >> bucketIndex;
+        return (size_t)(((int64_t)(bucketIndex + 1) << _subBucketHalfCountMagnitude) + (subBucketIndex - _subBucketHalfCount));
+    }
+
+    inline int64_t ValueFromIndex(size_t index) const
+    {
+        int bucketIndex = (int)(index >> _subBucketHalfCountMagnitude) - 1;
+        int64_t subBucketIndex = (int64_t)(index & (_subBucketHalfCount - 1)) + _subBucketHalfCount;
+        if (bucketIndex < 0)
+        {
+            subBucketIndex -= _subBucketHalfCount;
+            bucketIndex = 0;
+        }
+        return subBucketIndex << bucketIndex;
+    }
+
+    inline int64_t SizeOfEquivalentValueRange(int64_t value) const
+    {
+        int bucketIndex = BucketIndex(value);
+        int64_t subBucketIndex = value >> bucketIndex;
+        return (int64_t)1 << (subBucketIndex >= _subBucketCount ? bucketIndex + 1 : bucketIndex);
+    }
+
+    inline int64_t HighestEquivalentValue(int64_t value) const
+    {
+        return value + SizeOfEquivalentValueRange(value) - 1;
+    }
+
+    inline int64_t MedianEquivalentValue(int64_t value) const
+    {
+        return value + SizeOfEquivalentValueRange(value) / 2;
+    }
+
+    inline static uint64_t ZigZag(int64_t value)
+    {
+        return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+    }
+
+    inline static int64_t UnZigZag(uint64_t value)
+    {
+        return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+    }
+
+    inline static void WriteVarint(std::vector<uint8_t>& out, uint64_t value)
+    {
+        while (value >= 0x80)
+        {
+            out.push_back((uint8_t)(value | 0x80));
+            value >>= 7;
+        }
+        out.push_back((uint8_t)value);
+    }
+
+    inline static bool ReadVarint(const uint8_t* bytes, size_t byteCount, size_t* position, uint64_t* value)
+    {
+        *value = 0;
+        for (int shift = 0; shift < 64 && *position < byteCount; shift += 7)
+        {
+            auto byte = bytes[(*position)++];
+            *value |= (uint64_t)(byte & 0x7f) << shift;
+            if ((byte & 0x80) == 0)
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+private:
+    int64_t _highestTrackableValue;
+    int _significantFigures;
+    int _subBucketHalfCountMagnitude;
+    int64_t _subBucketCount;
+    int64_t _subBucketHalfCount;
+    int64_t _subBucketMask;
+    size_t _countsLength;
+    std::unique_ptr<std::atomic<int64_t>[]> _counts;
+    std::atomic<int64_t> _totalCount;
+};
+
+//---------------------------------------------------------------------
+//---------------------------------------------------------------------
+enum class SidebandLatencyKind
+{
+    WRITE = 0,
+    READ = 1,
+    ROUND_TRIP = 2
+};
+
+//---------------------------------------------------------------------
+// Per thread latency histograms for the sideband message helpers.  Each
+// thread records into its own histograms, Snapshot merges all of them.
+// Recording is off until Enable is called.
+//---------------------------------------------------------------------
+class SidebandLatencyRecorder
+{
+public:
+    static const int KindCount = 3;
+
+    static SidebandLatencyRecorder& Instance()
+    {
+        static SidebandLatencyRecorder recorder;
+        return recorder;
+    }
+
+    inline void Enable(bool enabled)
+    {
+        _enabled.store(enabled, std::memory_order_relaxed);
+    }
+
+    inline bool Enabled() const
+    {
+        return _enabled.load(std::memory_order_relaxed);
+    }
+
+    inline void Record(SidebandLatencyKind kind, int64_t nanoseconds)
+    {
+        if (Enabled())
+        {
+            ThreadHistograms().histograms[(int)kind].Record(nanoseconds);
+        }
+    }
+
+    inline std::unique_ptr<HdrHistogram> Snapshot(SidebandLatencyKind kind)
+    {
+        std::unique_ptr<HdrHistogram> merged(new HdrHistogram());
+        std::lock_guard<std::mutex> lock(_mutex);
+        for (auto& thread : _threads)
+        {
+            merged->Merge(thread->histograms[(int)kind]);
+        }
+        return merged;
+    }
+
+    inline void Reset()
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        for (auto& thread : _threads)
+        {
+            for (auto& histogram : thread->histograms)
+            {
+                histogram.Reset();
+            }
+        }
+    }
+
+    inline void WriteJson(std::ostream& out)
+    {
+        out << "{\"write\":";
+        Snapshot(SidebandLatencyKind::WRITE)->WriteJson(out);
+        out << ",\"read\":";
+        Snapshot(SidebandLatencyKind::READ)->WriteJson(out);
+        out << ",\"roundTrip\":";
+        Snapshot(SidebandLatencyKind::ROUND_TRIP)->WriteJson(out);
+        out << "}";
+    }
+
+    inline void WriteSummary(std::ostream& out)
+    {
+        const char* names[KindCount] = { "write", "read", "round trip" };
+        for (int x = 0; x < KindCount; ++x)
+        {
+            auto histogram = Snapshot((SidebandLatencyKind)x);
+            if (histogram->TotalCount() == 0)
+            {
+                continue;
+            }
+            out << "  " << names[x] << " latency (us): count " << histogram->TotalCount()
+                << ", p50 " << histogram->ValueAtPercentile(50) / 1000.0
+                << ", p99 " << histogram->ValueAtPercentile(99) / 1000.0
+                << ", p99.9 " << histogram->ValueAtPercentile(99.9) / 1000.0
+                << ", max " << histogram->Max() / 1000.0 << std::endl;
+        }
+    }
+
+private:
+    struct PerThread
+    {
+        HdrHistogram histograms[KindCount];
+    };
+
+    SidebandLatencyRecorder()
+        : _enabled(false)
+    {
+    }
+
+    inline PerThread& ThreadHistograms()
+    {
+        thread_local std::shared_ptr<PerThread> histograms = Register();
+        return *histograms;
+    }
+
+    inline std::shared_ptr<PerThread> Register()
+    {
+        auto histograms = std::make_shared<PerThread>();
+        std::lock_guard<std::mutex> lock(_mutex);
+        _threads.push_back(histograms);
+        return histograms;
+    }
+
+private:
+    std::atomic<bool> _enabled;
+    std::mutex _mutex;
+    std::vector<std::shared_ptr<PerThread>> _threads;
+};
@@ -0,0 +1,322 @@
+#pragma once
+
+//---------------------------------------------------------------------
+//---------------------------------------------------------------------
+#ifndef _WIN32
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
+
+//---------------------------------------------------------------------
+//---------------------------------------------------------------------
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "sideband_codec.h"
+#include "sideband_latency.h"
+
+//---------------------------------------------------------------------
+// Recording file layout, all little endian:
+//
+//   SidebandRecordingHeader
+//   SidebandRecordHeader + payload, padded to 8 bytes, one per frame
+//   SidebandRecordingIndexEntry, one per frame
+//   SidebandRecordingFooter
+//
+// Payloads are the sideband messages exactly as they arrived, so frames
+// of a compressed stream stay compressed and the header carries the
+// codec needed to decode them.  The index and footer are written by
+// Close; a file without them can still be read by scanning the records.
+//---------------------------------------------------------------------
+#define SIDEBAND_RECORDING_MAGIC "SBREC01"
+#define SIDEBAND_RECORDING_INDEX_MAGIC "SBIDX01"
+
+//---------------------------------------------------------------------
+//---------------------------------------------------------------------
+struct SidebandRecordingHeader
+{
+    char magic[8];
+    uint32_t headerSize;
+    uint8_t codec;
+    uint8_t reserved[3];
+    int64_t startTimestampNanoseconds;
+    uint64_t reservedWords[5];
+};
+
+//---------------------------------------------------------------------
+//---------------------------------------------------------------------
+struct SidebandRecordHeader
+{
+    uint32_t length;
+    uint32_t reserved;
+    uint64_t sequence;
+    int64_t timestampNanoseconds;
+};
+
+//---------------------------------------------------------------------
+//---------------------------------------------------------------------
+struct SidebandRecordingIndexEntry
+{
+    uint64_t sequence;
+    uint64_t offset;
+};
+
+//---------------------------------------------------------------------
+//---------------------------------------------------------------------
+struct SidebandRecordingFooter
+{
+    uint64_t indexOffset;
+    uint64_t frameCount;
+    char magic[8];
+};
+
+//---------------------------------------------------------------------
+// Appends frames to a memory mapped file.  The file grows in large
+// preallocated extents, so the common case of Append is one memcpy into
+// the mapping and the read loop never waits on the disk.  Append is
+// meant to be called from the single thread that reads the stream.
+//---------------------------------------------------------------------
+class SidebandRecorder
+{
+public:
+    static const int64_t DefaultExtentSize = 64 * 1024 * 1024;
+
+    SidebandRecorder()
+        : _fd(-1), _mapping(nullptr), _mappedSize(0), _offset(0), _extentSize(DefaultExtentSize), _sequence(0)
+    {
+    }
+
+    SidebandRecorder(const SidebandRecorder&) = delete;
+    SidebandRecorder& operator=(const SidebandRecorder&) = delete;
+
+    ~SidebandRecorder()
+    {
+        Close();
+    }
+
+    inline bool Open(const std::string& path, SidebandCodecSettings codec = SidebandCodecSettings { SidebandCodec::NONE }, int64_t extentSize = DefaultExtentSize)
+    {
+#ifdef _WIN32
+        return false;
+#else
+        Close();
+        _fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (_fd < 0)
+        {
+            return false;
+        }
+        _extentSize = extentSize < 4096 ? 4096 : extentSize;
+        _offset = 0;
+        _sequence = 0;
+        _index.clear();
+        if (!Reserve(sizeof(SidebandRecordingHeader)))
+        {
+            Close();
+            return false;
+        }
+        SidebandRecordingHeader header = {};
+        std::memcpy(header.magic, SIDEBAND_RECORDING_MAGIC, sizeof(header.magic));
+        header.headerSize = sizeof(header);
+        header.codec = (uint8_t)codec.codec;
+        header.startTimestampNanoseconds = SidebandTimestampNanoseconds();
+        std::memcpy(_mapping, &header, sizeof(header));
+        _offset = sizeof(header);
+        return true;
+#endif
+    }
+
+    inline bool IsOpen() const
+    {
+        return _mapping != nullptr;
+    }
+
+    inline bool Append(const uint8_t* bytes, int64_t byteCount)
+    {
+        if (_mapping == nullptr || byteCount < 0 || byteCount > UINT32_MAX)
+        {
+            return false;
+        }
+        auto recordSize = Align(sizeof(SidebandRecordHeader) + byteCount);
+        if (_offset + recordSize > _mappedSize && !Reserve(_offset + recordSize))
+        {
+            return false;
+        }
+        SidebandRecordHeader record = { (uint32_t)byteCount, 0, _sequence, SidebandTimestampNanoseconds() };
+        std::memcpy(_mapping + _offset, &record, sizeof(record));
+        std::memcpy(_mapping + _offset + sizeof(record), bytes, (size_t)byteCount);
+        _index.push_back(SidebandRecordingIndexEntry { _sequence, (uint64_t)_offset });
+        _offset += recordSize;
+        ++_sequence;
+        return true;
+    }
+
+    inline int64_t FrameCount() const
+    {
+        return (int64_t)_index.size();
+    }
+
+    inline int64_t BytesRecorded() const
+    {
+        return _offset;
+    }
+
+    // Writes the index and footer and trims the file to its used size.
+    inline bool Close()
+    {
+#ifdef _WIN32
+        return false;
+#else
+        if (_fd < 0)
+        {
+            return false;
+        }
+        bool success = false;
+        if (_mapping != nullptr)
+        {
+            auto indexBytes = (int64_t)(_index.size() * sizeof(SidebandRecordingIndexEntry));
+            auto fileSize = _offset + indexBytes + (int64_t)sizeof(SidebandRecordingFooter);
+            if (fileSize <= _mappedSize || Reserve(fileSize))
+            {
+                SidebandRecordingFooter footer = { (uint64_t)_offset, (uint64_t)_index.size(), {} };
+                std::memcpy(footer.magic, SIDEBAND_RECORDING_INDEX_MAGIC, sizeof(footer.magic));
+                if (indexBytes > 0)
+                {
+                    std::memcpy(_mapping + _offset, _index.data(), (size_t)indexBytes);
+                }
+                std::memcpy(_mapping + _offset + indexBytes, &footer, sizeof(footer));
+                msync(_mapping, (size_t)fileSize, MS_ASYNC);
+                success = ftruncate(_fd, fileSize) == 0;
+            }
+            munmap(_mapping, (size_t)_mappedSize);
+        }
+        close(_fd);
+        _fd = -1;
+        _mapping = nullptr;
+        _mappedSize = 0;
+        _index.clear();
+        return success;
+#endif
+    }
+
+private:
+    inline static int64_t Align(int64_t byteCount)
+    {
+        return (byteCount + 7) & ~(int64_t)7;
+    }
+
+    inline bool Reserve(int64_t requiredSize)
+    {
+#ifdef _WIN32
+        return false;
+#else
+        auto newSize = _mappedSize;
+        while (newSize < requiredSize)
+        {
+            newSize += _extentSize;
+        }
+    #ifdef __linux__
+        if (fallocate(_fd, 0, _mappedSize, newSize - _mappedSize) != 0 && ftruncate(_fd, newSize) != 0)
+    #else
+        if (ftruncate(_fd, newSize) != 0)
+    #endif
+        {
+            return false;
+        }
+        void* mapping = nullptr;
+    #ifdef __linux__
+        if (_mapping != nullptr)
+        {
+            mapping = mremap(_mapping, (size_t)_mappedSize, (size_t)newSize, MREMAP_MAYMOVE);
+        }
+        else
+    #endif
+        {
+            if (_mapping != nullptr)
+            {
+                munmap(_mapping, (size_t)_mappedSize);
+                _mapping = nullptr;
+                _mappedSize = 0;
+            }
+            mapping = mmap(nullptr, (size_t)newSize, PROT_READ | PROT_WRITE, MAP_SHARED, _fd, 0);
+        }
+        if (mapping == MAP_FAILED)
+        {
+            return false;
+        }
+        _mapping = static_cast<uint8_t*>(mapping);
+        _mappedSize = newSize;
+        madvise(_mapping, (size_t)_mappedSize, MADV_SEQUENTIAL);
+        return true;
+#endif
+    }
+
+private:
+    int _fd;
+    uint8_t* _mapping;
+    int64_t _mappedSize;
+    int64_t _offset;
+    int64_t _extentSize;
+    uint64_t _sequence;
+    std::vector<SidebandRecordingIndexEntry> _index;
+};
+
+//---------------------------------------------------------------------
+// Recorders attached to client tokens.  ReadSidebandMessage tees every
+// frame it reads on an attached token into the recorder.
+//---------------------------------------------------------------------
+class SidebandRecorderTable
+{
+public:
+    static SidebandRecorderTable& Instance()
+    {
+        static SidebandRecorderTable table;
+        return table;
+    }
+
+    inline void Attach(int64_t dataToken, SidebandRecorder* recorder)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (recorder == nullptr)
+        {
+            _recorders.erase(dataToken);
+        }
+        else
+        {
+            _recorders[dataToken] = recorder;
+        }
+        _count.store((int64_t)_recorders.size(), std::memory_order_relaxed);
+    }
+
+    inline SidebandRecorder* Find(int64_t dataToken)
+    {
+        if (_count.load(std::memory_order_relaxed) == 0)
+        {
+            return nullptr;
+        }
+        std::lock_guard<std::mutex> lock(_mutex);
+        auto it = _recorders.find(dataToken);
+        return it == _recorders.end() ? nullptr : it->second;
+    }
+
+    inline void Detach(int64_t dataToken)
+    {
+        Attach(dataToken, nullptr);
+    }
+
+private:
+    SidebandRecorderTable()
+        : _count(0)
+    {
+    }
+
+private:
+    std::mutex _mutex;
+    std::atomic<int64_t> _count;
+    std::unordered_map<int64_t, SidebandRecorder*> _recorders;
+};
@@ -0,0 +1,414 @@
+#pragma once
+
+//---------------------------------------------------------------------
+//---------------------------------------------------------------------
+#ifndef _WIN32
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
+
+//---------------------------------------------------------------------
+//---------------------------------------------------------------------
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <unordered_set>
+#include <vector>
+#include "sideband_internal.h"
+#include "sideband_cancel.h"
+#include "sideband_codec.h"
+#include "sideband_recorder.h"
+
+//---------------------------------------------------------------------
+// Serves a file written by SidebandRecorder as a read only sideband
+// stream.  Direct reads point straight into the read only mapping, so a
+// replay runs at memory bandwidth when speed is 0.  A speed of 1 keeps
+// the recorded spacing between frames and N plays N times faster.
+//
+// Once the recording is exhausted every read returns a cancel frame
+// (SidebandReadResponse with cancel set) so moniker loops end cleanly.
+//---------------------------------------------------------------------
+class ReplaySidebandData : public SidebandData, public SidebandInterruptible
+{
+public:
+    ReplaySidebandData(const std::string& path, double speed)
+        : SidebandData(0), _path(path), _speed(speed < 0 ? 0 : speed), _mapping(nullptr), _mappedSize(0), _next(0), _started(false), _cancelled(false)
+    {
+        _codec = SidebandCodecSettings { SidebandCodec::NONE };
+    }
+
+    virtual ~ReplaySidebandData()
+    {
+#ifndef _WIN32
+        if (_mapping != nullptr)
+        {
+            munmap(const_cast<uint8_t*>(_mapping), (size_t)_mappedSize);
+        }
+#endif
+    }
+
+    inline bool Open()
+    {
+#ifdef _WIN32
+        return false;
+#else
+        auto fd = open(_path.c_str(), O_RDONLY);
+        if (fd < 0)
+        {
+            return false;
+        }
+        struct stat fileStat;
+        if (fstat(fd, &fileStat) != 0 || fileStat.st_size < (off_t)sizeof(SidebandRecordingHeader))
+        {
+            close(fd);
+            return false;
+        }
+        _mappedSize = fileStat.st_size;
+        auto mapping = mmap(nullptr, (size_t)_mappedSize, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if (mapping == MAP_FAILED)
+        {
+            return false;
+        }
+        _mapping = static_cast<const uint8_t*>(mapping);
+        madvise(mapping, (size_t)_mappedSize, MADV_SEQUENTIAL | MADV_WILLNEED);
+
+        SidebandRecordingHeader header;
+        std::memcpy(&header, _mapping, sizeof(header));
+        if (std::memcmp(header.magic, SIDEBAND_RECORDING_MAGIC, sizeof(header.magic)) != 0)
+        {
+            return false;
+        }
+        _codec = SidebandCodecSettings { (SidebandCodec)header.codec };
+        if (!LoadIndex())
+        {
+            ScanRecords(header.headerSize);
+        }
+        BuildEndOfStreamFrame();
+        return true;
+#endif
+    }
+
+    inline SidebandCodecSettings Codec() const
+    {
+        return _codec;
+    }
+
+    inline int64_t FrameCount() const
+    {
+        return (int64_t)_frames.size();
+    }
+
+    // Starts the replay again from the first frame.
+    inline void Rewind()
+    {
+        _next = 0;
+        _started = false;
+    }
+
+    const std::string& UsageId() override
+    {
+        return _path;
+    }
+
+    bool Write(const uint8_t* bytes, int64_t byteCount) override
+    {
+        return false;
+    }
+
+    bool WriteLengthPrefixed(const uint8_t* bytes, int64_t byteCount) override
+    {
+        return false;
+    }
+
+    // Fails on a frame larger than bufferSize and does not move past it.
+    bool Read(uint8_t* bytes, int64_t bufferSize, int64_t* numBytesRead) override
+    {
+        int64_t frameSize = 0;
+        auto frame = PeekFrame(&frameSize);
+        *numBytesRead = 0;
+        if (frameSize > bufferSize)
+        {
+            return false;
+        }
+        ConsumeFrame(frame);
+        std::memcpy(bytes, frame, (size_t)frameSize);
+        *numBytesRead = frameSize;
+        return true;
+    }
+
+    bool ReadFromLengthPrefixed(uint8_t* bytes, int64_t bufferSize, int64_t* numBytesRead) override
+    {
+        return Read(bytes, bufferSize, numBytesRead);
+    }
+
+    int64_t ReadLengthPrefix() override
+    {
+        int64_t frameSize = 0;
+        PeekFrame(&frameSize);
+        return frameSize;
+    }
+
+    bool SupportsDirectReadWrite() override
+    {
+        return true;
+    }
+
+    const uint8_t* BeginDirectRead(int64_t byteCount) override
+    {
+        int64_t frameSize = 0;
+        return NextFrame(&frameSize);
+    }
+
+    const uint8_t* BeginDirectReadLengthPrefixed(int64_t* bufferSize) override
+    {
+        return NextFrame(bufferSize);
+    }
+
+    bool FinishDirectRead() override
+    {
+        return true;
+    }
+
+    // Waits for the next frame to become due under the replay speed.
+    int32_t WaitForData(int64_t timeoutMicroseconds) override
+    {
+        std::chrono::steady_clock::time_point due;
+        if (!NextDue(&due))
+        {
+            return _cancelled.load(std::memory_order_acquire) ? SIDEBAND_CANCELLED : 0;
+        }
+        if (timeoutMicroseconds >= 0 && due > std::chrono::steady_clock::now() + std::chrono::microseconds(timeoutMicroseconds))
+        {
+            SleepUntil(std::chrono::steady_clock::now() + std::chrono::microseconds(timeoutMicroseconds));
+            return _cancelled.load(std::memory_order_acquire) ? SIDEBAND_CANCELLED : SIDEBAND_TIMED_OUT;
+        }
+        SleepUntil(due);
+        return _cancelled.load(std::memory_order_acquire) ? SIDEBAND_CANCELLED : 0;
+    }
+
+    // Cuts the pacing sleep short, every later read gets the cancel frame.
+    void Cancel() override
+    {
+        {
+            std::lock_guard<std::mutex> lock(_wakeLock);
+            _cancelled.store(true, std::memory_order_seq_cst);
+        }
+        _wake.notify_all();
+    }
+
+public:
+    static ReplaySidebandData* InitNew(const std::string& path, double speed)
+    {
+        auto replay = new ReplaySidebandData(path, speed);
+        if (!replay->Open())
+        {
+            delete replay;
+            return nullptr;
+        }
+        {
+            std::lock_guard<std::mutex> lock(ReplayLock());
+            ReplayTokens().insert(reinterpret_cast<int64_t>(replay));
+        }
+        SidebandCancelTable::Instance().AddInterruptible(reinterpret_cast<int64_t>(replay), replay);
+        return replay;
+    }
+
+    // Returns false if the token is not a replay.
+    static bool Close(int64_t dataToken)
+    {
+        {
+            std::lock_guard<std::mutex> lock(ReplayLock());
+            if (ReplayTokens().erase(dataToken) == 0)
+            {
+                return false;
+            }
+        }
+        SidebandCancelTable::Instance().Remove(dataToken);
+        delete reinterpret_cast<ReplaySidebandData*>(dataToken);
+        return true;
+    }
+
+private:
+    struct Frame
+    {
+        const uint8_t* data;
+        int64_t size;
+        int64_t timestampNanoseconds;
+    };
+
+    static std::mutex& ReplayLock()
+    {
+        static std::mutex lock;
+        return lock;
+    }
+
+    static std::unordered_set<int64_t>& ReplayTokens()
+    {
+        static std::unordered_set<int64_t> tokens;
+        return tokens;
+    }
+
+    inline bool AddFrame(uint64_t offset)
+    {
+        if (offset + sizeof(SidebandRecordHeader) > (uint64_t)_mappedSize)
+        {
+            return false;
+        }
+        SidebandRecordHeader record;
+        std::memcpy(&record, _mapping + offset, sizeof(record));
+        if (offset + sizeof(record) + record.length > (uint64_t)_mappedSize)
+        {
+            return false;
+        }
+        _frames.push_back(Frame { _mapping + offset + sizeof(record), record.length, record.timestampNanoseconds });
+        return true;
+    }
+
+    inline bool LoadIndex()
+    {
+        SidebandRecordingFooter footer;
+        if (_mappedSize < (int64_t)(sizeof(SidebandRecordingHeader) + sizeof(footer)))
+        {
+            return false;
+        }
+        std::memcpy(&footer, _mapping + _mappedSize - sizeof(footer), sizeof(footer));
+        // frameCount is bounded by the bytes in front of the footer before
+        // it is multiplied, so a corrupt footer cannot wrap the check.
+        auto indexEnd = (uint64_t)_mappedSize - sizeof(footer);
+        if (std::memcmp(footer.magic, SIDEBAND_RECORDING_INDEX_MAGIC, sizeof(footer.magic)) != 0
+            || footer.indexOffset > indexEnd
+            || footer.frameCount > (indexEnd - footer.indexOffset) / sizeof(SidebandRecordingIndexEntry)
+            || footer.indexOffset + footer.frameCount * sizeof(SidebandRecordingIndexEntry) != indexEnd)
+        {
+            return false;
+        }
+        _frames.reserve((size_t)footer.frameCount);
+        for (uint64_t x = 0; x < footer.frameCount; ++x)
+        {
+            SidebandRecordingIndexEntry entry;
+            std::memcpy(&entry, _mapping + footer.indexOffset + x * sizeof(entry), sizeof(entry));
+            if (!AddFrame(entry.offset))
+            {
+                _frames.clear();
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Recovers the frames of a recording that was never closed.  The
+    // unused tail of the last extent is zero filled, which ends the scan.
+    inline void ScanRecords(uint64_t offset)
+    {
+        _frames.clear();
+        uint64_t sequence = 0;
+        while (offset + sizeof(SidebandRecordHeader) <= (uint64_t)_mappedSize)
+        {
+            SidebandRecordHeader record;
+            std::memcpy(&record, _mapping + offset, sizeof(record));
+            if (record.sequence != sequence || (record.length == 0 && record.timestampNanoseconds == 0) || !AddFrame(offset))
+            {
+                break;
+            }
+            offset += (sizeof(record) + record.length + 7) & ~(uint64_t)7;
+            ++sequence;
+        }
+    }
+
+    inline void BuildEndOfStreamFrame()
+    {
+        const uint8_t cancelFrame[] = { 0x08, 0x01 };
+        if (_codec.codec == SidebandCodec::NONE)
+        {
+            _endOfStream.assign(cancelFrame, cancelFrame + sizeof(cancelFrame));
+            return;
+        }
+        SidebandCodecHeader header = {};
+        header.codec = (uint8_t)_codec.codec;
+        header.uncompressedSize = sizeof(cancelFrame);
+        _endOfStream.resize(sizeof(header) + SidebandLz4::CompressBound(sizeof(cancelFrame)));
+        std::memcpy(_endOfStream.data(), &header, sizeof(header));
+        auto size = SidebandLz4::Compress(cancelFrame, sizeof(cancelFrame), _endOfStream.data() + sizeof(header));
+        _endOfStream.resize(sizeof(header) + size);
+    }
+
+    // Returns false when the next read does not wait: the replay is not
+    // paced, exhausted or cancelled.
+    inline bool NextDue(std::chrono::steady_clock::time_point* due)
+    {
+        if (_speed <= 0 || _next >= _frames.size() || _cancelled.load(std::memory_order_acquire))
+        {
+            return false;
+        }
+        if (!_started)
+        {
+            _replayStart = std::chrono::steady_clock::now();
+            _started = true;
+        }
+        auto offset = std::chrono::nanoseconds((int64_t)((_frames[_next].timestampNanoseconds - _frames[0].timestampNanoseconds) / _speed));
+        *due = _replayStart + offset;
+        return true;
+    }
+
+    inline void SleepUntil(std::chrono::steady_clock::time_point deadline)
+    {
+        std::unique_lock<std::mutex> lock(_wakeLock);
+        _wake.wait_until(lock, deadline, [this]() { return _cancelled.load(std::memory_order_acquire); });
+    }
+
+    inline const uint8_t* PeekFrame(int64_t* frameSize)
+    {
+        std::chrono::steady_clock::time_point due;
+        if (NextDue(&due))
+        {
+            SleepUntil(due);
+        }
+        if (_next >= _frames.size() || _cancelled.load(std::memory_order_acquire))
+        {
+            *frameSize = (int64_t)_endOfStream.size();
+            return _endOfStream.data();
+        }
+        auto& frame = _frames[_next];
+        *frameSize = frame.size;
+        return frame.data;
+    }
+
+    // Moves past a frame from PeekFrame.  The end of stream frame is
+    // returned again by every later read, also after a cancel.
+    inline void ConsumeFrame(const uint8_t* frame)
+    {
+        if (frame != _endOfStream.data())
+        {
+            ++_next;
+        }
+    }
+
+    inline const uint8_t* NextFrame(int64_t* frameSize)
+    {
+        auto frame = PeekFrame(frameSize);
+        ConsumeFrame(frame);
+        return frame;
+    }
+
+private:
+    std::string _path;
+    double _speed;
+    SidebandCodecSettings _codec;
+    const uint8_t* _mapping;
+    int64_t _mappedSize;
+    std::vector<Frame> _frames;
+    std::vector<uint8_t> _endOfStream;
+    size_t _next;
+    bool _started;
+    std::chrono::steady_clock::time_point _replayStart;
+    std::atomic<bool> _cancelled;
+    std::mutex _wakeLock;
+    std::condition_variable _wake;
+};
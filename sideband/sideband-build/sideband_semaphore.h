@@ -4,6 +4,22 @@
 //---------------------------------------------------------------------
 #include <mutex>
 #include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+#ifdef _WIN32
+    #ifndef WIN32_LEAN_AND_MEAN
+        #define WIN32_LEAN_AND_MEAN
+    #endif
+    #include <windows.h>
+    #pragma comment(lib, "Synchronization.lib")
+#else
+    #include <ctime>
+    #include <unistd.h>
+    #include <sys/syscall.h>
+    #include <linux/futex.h>
+#endif
 
 class Semaphore
 {
@@ -36,3 +52,122 @@ private:
     std::condition_variable cv;
     int count;
 };
+
+//---------------------------------------------------------------------
+// Counting semaphore built on a single atomic word, for the helpers in
+// these headers.  notify() and a successful wait() never enter the
+// kernel unless a thread is actually blocked, so the uncontended handoff
+// is a couple of atomic operations.  Semaphore above is the type the
+// sideband library was built with; the library exports its members, so
+// it keeps its name and layout.
+//
+// The object holds only atomics, so it can live inside a shared memory
+// mapping.  Pass processShared = true in that case so the futex is not
+// keyed on the process private address space (Linux only, WaitOnAddress
+// is always process local).
+//---------------------------------------------------------------------
+class SidebandFutexSemaphore
+{
+public:
+    SidebandFutexSemaphore(int count_ = 1, bool processShared_ = false)
+        : count(count_), waiters(0), processShared(processShared_)
+    {
+    }
+
+    SidebandFutexSemaphore(const SidebandFutexSemaphore&) = delete;
+    SidebandFutexSemaphore& operator=(const SidebandFutexSemaphore&) = delete;
+
+    inline void notify()
+    {
+        count.fetch_add(1, std::memory_order_release);
+        if (waiters.load(std::memory_order_seq_cst) > 0)
+        {
+            wake();
+        }
+    }
+
+    inline bool try_wait()
+    {
+        int32_t current = count.load(std::memory_order_relaxed);
+        while (current > 0)
+        {
+            if (count.compare_exchange_weak(current, current - 1, std::memory_order_acquire, std::memory_order_relaxed))
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    inline void wait()
+    {
+        while (!try_wait())
+        {
+            waiters.fetch_add(1, std::memory_order_seq_cst);
+            if (count.load(std::memory_order_seq_cst) == 0)
+            {
+                block(-1);
+            }
+            waiters.fetch_sub(1, std::memory_order_relaxed);
+        }
+    }
+
+    template <class Rep, class Period>
+    inline bool wait_for(const std::chrono::duration<Rep, Period>& timeout)
+    {
+        auto deadline = std::chrono::steady_clock::now() + timeout;
+        while (!try_wait())
+        {
+            auto remaining = std::chrono::duration_cast<std::chrono::microseconds>(deadline - std::chrono::steady_clock::now()).count();
+            if (remaining <= 0)
+            {
+                return false;
+            }
+            waiters.fetch_add(1, std::memory_order_seq_cst);
+            if (count.load(std::memory_order_seq_cst) == 0)
+            {
+                block(remaining);
+            }
+            waiters.fetch_sub(1, std::memory_order_relaxed);
+        }
+        return true;
+    }
+
+private:
+    inline void wake()
+    {
+#ifdef _WIN32
+        WakeByAddressSingle(&count);
+#else
+        syscall(SYS_futex, &count, processShared ? FUTEX_WAKE : FUTEX_WAKE_PRIVATE, 1, nullptr, nullptr, 0);
+#endif
+    }
+
+    // Sleeps while count is still zero, timeoutMicroseconds < 0 waits forever.
+    // Spurious returns are fine, callers always retry try_wait().
+    inline void block(int64_t timeoutMicroseconds)
+    {
+#ifdef _WIN32
+        int32_t zero = 0;
+        DWORD milliseconds = timeoutMicroseconds < 0 ? INFINITE : (DWORD)((timeoutMicroseconds + 999) / 1000);
+        WaitOnAddress(&count, &zero, sizeof(zero), milliseconds);
+#else
+        timespec relative;
+        timespec* timeout = nullptr;
+        if (timeoutMicroseconds >= 0)
+        {
+            relative.tv_sec = timeoutMicroseconds / 1000000;
+            relative.tv_nsec = (timeoutMicroseconds % 1000000) * 1000;
+            timeout = &relative;
+        }
+        syscall(SYS_futex, &count, processShared ? FUTEX_WAIT : FUTEX_WAIT_PRIVATE, 0, timeout, nullptr, 0);
+#endif
+    }
+
+private:
+    std::atomic<int32_t> count;
+    std::atomic<int32_t> waiters;
+    bool processShared;
+};
+
+static_assert(sizeof(std::atomic<int32_t>) == sizeof(int32_t), "SidebandFutexSemaphore requires a lock free 32 bit atomic for futex waits");
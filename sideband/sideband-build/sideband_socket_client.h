@@ -0,0 +1,261 @@
+#pragma once
+
+//---------------------------------------------------------------------
+//---------------------------------------------------------------------
+#ifdef _WIN32
+    #ifndef WIN32_LEAN_AND_MEAN
+        #define WIN32_LEAN_AND_MEAN
+    #endif
+    #include <winsock2.h>
+    #include <ws2tcpip.h>
+    #pragma comment(lib, "Ws2_32.lib")
+#else
+    #include <netdb.h>
+    #include <netinet/in.h>
+    #include <netinet/tcp.h>
+    #include <sys/socket.h>
+    #include <unistd.h>
+#endif
+
+//---------------------------------------------------------------------
+//---------------------------------------------------------------------
+#include <cerrno>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_set>
+#include "sideband_cancel.h"
+#include "sideband_data.h"
+#include "sideband_internal.h"
+
+//---------------------------------------------------------------------
+// A socket stream read and written by the helpers instead of the
+// sideband library, on the library's wire format: frames carry an int64
+// length prefix, Read and ReadFromLengthPrefixed fill the whole buffer.
+// Unlike the library it sends with MSG_NOSIGNAL and fails a recv that
+// returns 0, so SidebandData_Cancel can shut the socket down under a
+// blocked reader or writer without raising SIGPIPE or leaving the
+// reader spinning.
+//---------------------------------------------------------------------
+class SidebandClientSocketData : public SidebandData
+{
+public:
+    SidebandClientSocketData(uint64_t socket, const std::string& usageId, int64_t bufferSize)
+        : SidebandData(bufferSize), _socket(socket), _usageId(usageId)
+    {
+    }
+
+    ~SidebandClientSocketData() override
+    {
+        CloseSocket(_socket);
+    }
+
+    const std::string& UsageId() override
+    {
+        return _usageId;
+    }
+
+    bool Write(const uint8_t* bytes, int64_t byteCount) override
+    {
+        return SendAll(_socket, bytes, byteCount);
+    }
+
+    bool Read(uint8_t* bytes, int64_t bufferSize, int64_t* numBytesRead) override
+    {
+        *numBytesRead = 0;
+        if (!ReceiveAll(_socket, bytes, bufferSize))
+        {
+            return false;
+        }
+        *numBytesRead = bufferSize;
+        return true;
+    }
+
+    bool WriteLengthPrefixed(const uint8_t* bytes, int64_t byteCount) override
+    {
+        return SendAll(_socket, reinterpret_cast<const uint8_t*>(&byteCount), sizeof(byteCount)) && SendAll(_socket, bytes, byteCount);
+    }
+
+    bool ReadFromLengthPrefixed(uint8_t* bytes, int64_t bufferSize, int64_t* numBytesRead) override
+    {
+        return Read(bytes, bufferSize, numBytesRead);
+    }
+
+    int64_t ReadLengthPrefix() override
+    {
+        int64_t length = 0;
+        return ReceiveAll(_socket, reinterpret_cast<uint8_t*>(&length), sizeof(length)) ? length : -1;
+    }
+
+    inline static bool SendAll(uint64_t socket, const uint8_t* bytes, int64_t byteCount)
+    {
+        while (byteCount > 0)
+        {
+#ifdef MSG_NOSIGNAL
+            auto sent = send(socket, (const char*)bytes, (int)byteCount, MSG_NOSIGNAL);
+#else
+            auto sent = send(socket, (const char*)bytes, (int)byteCount, 0);
+#endif
+            if (sent <= 0)
+            {
+                return false;
+            }
+            bytes += sent;
+            byteCount -= sent;
+        }
+        return true;
+    }
+
+    inline static bool ReceiveAll(uint64_t socket, uint8_t* bytes, int64_t byteCount)
+    {
+        while (byteCount > 0)
+        {
+            auto received = recv(socket, (char*)bytes, (int)byteCount, 0);
+#ifndef _WIN32
+            if (received < 0 && errno == EINTR)
+            {
+                continue;
+            }
+#endif
+            if (received <= 0)
+            {
+                return false;
+            }
+            bytes += received;
+            byteCount -= received;
+        }
+        return true;
+    }
+
+    inline static void CloseSocket(uint64_t socket)
+    {
+#ifdef _WIN32
+        closesocket((SOCKET)socket);
+#else
+        close((int)socket);
+#endif
+    }
+
+private:
+    uint64_t _socket;
+    std::string _usageId;
+};
+
+//---------------------------------------------------------------------
+// Socket streams connected by the helpers instead of the sideband
+// library, for InitCancellableClientSidebandData.  The socket is
+// connected, tuned and sent the usage id the same way the library does
+// it, so the server cannot tell the two apart, but the helpers own the
+// descriptor and every call on it, so it can be waited on with a timeout
+// and cancelled, see sideband_cancel.h.
+//---------------------------------------------------------------------
+class SidebandClientSockets
+{
+public:
+    static SidebandClientSockets& Instance()
+    {
+        static SidebandClientSockets sockets;
+        return sockets;
+    }
+
+    inline bool Connect(const std::string& sidebandServiceUrl, const std::string& usageId, int64_t bufferSize, bool lowLatency, int64_t* out_tokenId)
+    {
+        uint64_t socket = 0;
+        if (!ConnectSocket(sidebandServiceUrl, bufferSize, lowLatency, &socket))
+        {
+            return false;
+        }
+        if (!SidebandClientSocketData::SendAll(socket, reinterpret_cast<const uint8_t*>(usageId.c_str()), (int64_t)usageId.length()))
+        {
+            SidebandClientSocketData::CloseSocket(socket);
+            return false;
+        }
+        auto sidebandData = new SidebandClientSocketData(socket, usageId, bufferSize);
+        *out_tokenId = reinterpret_cast<int64_t>(sidebandData);
+        SidebandCancelTable::Instance().AddSocket(*out_tokenId, socket);
+        std::lock_guard<std::mutex> lock(_mutex);
+        _tokens.insert(*out_tokenId);
+        return true;
+    }
+
+    // Closes a token from Connect.  Returns false if the token is not
+    // one of these.
+    inline bool Close(int64_t dataToken)
+    {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            if (_tokens.erase(dataToken) == 0)
+            {
+                return false;
+            }
+        }
+        SidebandCancelTable::Instance().Remove(dataToken);
+        delete reinterpret_cast<SidebandData*>(dataToken);
+        return true;
+    }
+
+private:
+    SidebandClientSockets() = default;
+
+    inline static bool ConnectSocket(const std::string& sidebandServiceUrl, int64_t bufferSize, bool lowLatency, uint64_t* out_socket)
+    {
+        auto tokens = SplitUrlString(sidebandServiceUrl);
+        if (tokens.size() < 2)
+        {
+            return false;
+        }
+
+        addrinfo hints = {};
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        hints.ai_protocol = IPPROTO_TCP;
+        addrinfo* addresses = nullptr;
+        if (getaddrinfo(tokens[0].c_str(), tokens[1].c_str(), &hints, &addresses) != 0)
+        {
+            return false;
+        }
+
+        bool connected = false;
+        for (auto address = addresses; address != nullptr && !connected; address = address->ai_next)
+        {
+            auto s = ::socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+#ifdef _WIN32
+            if (s == INVALID_SOCKET)
+#else
+            if (s < 0)
+#endif
+            {
+                continue;
+            }
+            int size = (int)bufferSize;
+            setsockopt(s, SOL_SOCKET, SO_SNDBUF, (const char*)&size, sizeof(size));
+            setsockopt(s, SOL_SOCKET, SO_RCVBUF, (const char*)&size, sizeof(size));
+            if (lowLatency)
+            {
+                int noDelay = 1;
+                setsockopt(s, IPPROTO_TCP, TCP_NODELAY, (const char*)&noDelay, sizeof(noDelay));
+            }
+#ifdef SO_NOSIGPIPE
+            // Platforms without MSG_NOSIGNAL fail a send on a cancelled
+            // socket this way instead of raising SIGPIPE.
+            int noSigPipe = 1;
+            setsockopt(s, SOL_SOCKET, SO_NOSIGPIPE, (const char*)&noSigPipe, sizeof(noSigPipe));
+#endif
+            if (connect(s, address->ai_addr, (int)address->ai_addrlen) == 0)
+            {
+                *out_socket = (uint64_t)s;
+                connected = true;
+            }
+            else
+            {
+                SidebandClientSocketData::CloseSocket((uint64_t)s);
+            }
+        }
+        freeaddrinfo(addresses);
+        return connected;
+    }
+
+private:
+    std::mutex _mutex;
+    std::unordered_set<int64_t> _tokens;
+};
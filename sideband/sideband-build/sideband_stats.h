@@ -0,0 +1,321 @@
+#pragma once
+
+//---------------------------------------------------------------------
+//---------------------------------------------------------------------
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include "sideband_data.h"
+
+//---------------------------------------------------------------------
+//---------------------------------------------------------------------
+#define SIDEBAND_STATS_HISTOGRAM_BUCKETS 32
+
+//---------------------------------------------------------------------
+// Snapshot returned by SidebandData_GetStats.  Bucket i of the blocked
+// time histograms counts calls that took [2^i, 2^(i+1)) nanoseconds, the
+// last bucket also holds everything slower.
+//---------------------------------------------------------------------
+struct SidebandStats
+{
+    int64_t bytesWritten;
+    int64_t bytesRead;
+    int64_t messagesWritten;
+    int64_t messagesRead;
+    int64_t directWrites;
+    int64_t copyWrites;
+    int64_t directReads;
+    int64_t copyReads;
+    int64_t serializeBufferGrowths;
+    int64_t uncompressedBytes;
+    int64_t compressedBytes;
+    int64_t codecNanoseconds;
+    int64_t errorCount;
+    int32_t lastErrorCode;
+    int32_t lastSocketError;
+    int64_t writeBlockedNanoseconds[SIDEBAND_STATS_HISTOGRAM_BUCKETS];
+    int64_t readBlockedNanoseconds[SIDEBAND_STATS_HISTOGRAM_BUCKETS];
+};
+
+//---------------------------------------------------------------------
+// Live counters for one token.  Only relaxed atomic adds on the hot
+// path, so they are cheap enough to leave on.
+//---------------------------------------------------------------------
+class SidebandTokenStats
+{
+public:
+    using Counter = std::atomic<int64_t>;
+    using Histogram = std::array<Counter, SIDEBAND_STATS_HISTOGRAM_BUCKETS>;
+
+    inline void RecordWrite(int64_t byteCount, bool direct, int64_t blockedNanoseconds)
+    {
+        Add(bytesWritten, byteCount);
+        Add(messagesWritten, 1);
+        Add(direct ? directWrites : copyWrites, 1);
+        Add(writeBlocked[Bucket(blockedNanoseconds)], 1);
+    }
+
+    inline void RecordRead(int64_t byteCount, bool direct, int64_t blockedNanoseconds)
+    {
+        Add(bytesRead, byteCount);
+        Add(messagesRead, 1);
+        Add(direct ? directReads : copyReads, 1);
+        Add(readBlocked[Bucket(blockedNanoseconds)], 1);
+    }
+
+    inline void RecordSerializeBufferGrowth()
+    {
+        Add(serializeBufferGrowths, 1);
+    }
+
+    inline void RecordCodec(int64_t uncompressedByteCount, int64_t compressedByteCount, int64_t nanoseconds)
+    {
+        Add(uncompressedBytes, uncompressedByteCount);
+        Add(compressedBytes, compressedByteCount);
+        Add(codecNanoseconds, nanoseconds);
+    }
+
+    inline void RecordError(int32_t errorCode, int32_t socketError)
+    {
+        Add(errorCount, 1);
+        lastErrorCode.store(errorCode, std::memory_order_relaxed);
+        lastSocketError.store(socketError, std::memory_order_relaxed);
+    }
+
+    inline void CopyTo(SidebandStats* stats) const
+    {
+        stats->bytesWritten = bytesWritten.load(std::memory_order_relaxed);
+        stats->bytesRead = bytesRead.load(std::memory_order_relaxed);
+        stats->messagesWritten = messagesWritten.load(std::memory_order_relaxed);
+        stats->messagesRead = messagesRead.load(std::memory_order_relaxed);
+        stats->directWrites = directWrites.load(std::memory_order_relaxed);
+        stats->copyWrites = copyWrites.load(std::memory_order_relaxed);
+        stats->directReads = directReads.load(std::memory_order_relaxed);
+        stats->copyReads = copyReads.load(std::memory_order_relaxed);
+        stats->serializeBufferGrowths = serializeBufferGrowths.load(std::memory_order_relaxed);
+        stats->uncompressedBytes = uncompressedBytes.load(std::memory_order_relaxed);
+        stats->compressedBytes = compressedBytes.load(std::memory_order_relaxed);
+        stats->codecNanoseconds = codecNanoseconds.load(std::memory_order_relaxed);
+        stats->errorCount = errorCount.load(std::memory_order_relaxed);
+        stats->lastErrorCode = lastErrorCode.load(std::memory_order_relaxed);
+        stats->lastSocketError = lastSocketError.load(std::memory_order_relaxed);
+        for (int x = 0; x < SIDEBAND_STATS_HISTOGRAM_BUCKETS; ++x)
+        {
+            stats->writeBlockedNanoseconds[x] = writeBlocked[x].load(std::memory_order_relaxed);
+            stats->readBlockedNanoseconds[x] = readBlocked[x].load(std::memory_order_relaxed);
+        }
+    }
+
+    inline void Reset()
+    {
+        for (auto counter : { &bytesWritten, &bytesRead, &messagesWritten, &messagesRead, &directWrites, &copyWrites, &directReads, &copyReads, &serializeBufferGrowths, &uncompressedBytes, &compressedBytes, &codecNanoseconds, &errorCount })
+        {
+            counter->store(0, std::memory_order_relaxed);
+        }
+        lastErrorCode.store(0, std::memory_order_relaxed);
+        lastSocketError.store(0, std::memory_order_relaxed);
+        for (int x = 0; x < SIDEBAND_STATS_HISTOGRAM_BUCKETS; ++x)
+        {
+            writeBlocked[x].store(0, std::memory_order_relaxed);
+            readBlocked[x].store(0, std::memory_order_relaxed);
+        }
+    }
+
+private:
+    inline static void Add(Counter& counter, int64_t value)
+    {
+        counter.fetch_add(value, std::memory_order_relaxed);
+    }
+
+    inline static int Bucket(int64_t nanoseconds)
+    {
+        int bucket = 0;
+        while (nanoseconds > 1 && bucket < SIDEBAND_STATS_HISTOGRAM_BUCKETS - 1)
+        {
+            nanoseconds >>= 1;
+            ++bucket;
+        }
+        return bucket;
+    }
+
+private:
+    Counter bytesWritten { 0 };
+    Counter bytesRead { 0 };
+    Counter messagesWritten { 0 };
+    Counter messagesRead { 0 };
+    Counter directWrites { 0 };
+    Counter copyWrites { 0 };
+    Counter directReads { 0 };
+    Counter copyReads { 0 };
+    Counter serializeBufferGrowths { 0 };
+    Counter uncompressedBytes { 0 };
+    Counter compressedBytes { 0 };
+    Counter codecNanoseconds { 0 };
+    Counter errorCount { 0 };
+    std::atomic<int32_t> lastErrorCode { 0 };
+    std::atomic<int32_t> lastSocketError { 0 };
+    Histogram writeBlocked {};
+    Histogram readBlocked {};
+};
+
+//---------------------------------------------------------------------
+// Fixed size open addressing table from token to counters.  Lookups and
+// inserts are a CAS on the slot key, so recording never takes a lock.
+// Slots are retired by CloseClientSidebandData and when a new token is
+// registered, so a token at a reused address starts from zero.  Tokens
+// that find the table full are not recorded; Overflows() counts them.
+//---------------------------------------------------------------------
+class SidebandStatsRegistry
+{
+public:
+    static SidebandStatsRegistry& Instance()
+    {
+        static SidebandStatsRegistry registry;
+        return registry;
+    }
+
+    inline SidebandTokenStats* Find(int64_t dataToken, bool create)
+    {
+        if (dataToken == EmptySlot || dataToken == RetiredSlot)
+        {
+            return nullptr;
+        }
+        auto start = Hash(dataToken);
+        for (size_t probe = 0; probe < SlotCount; ++probe)
+        {
+            auto& slot = _slots[(start + probe) % SlotCount];
+            auto key = slot.token.load(std::memory_order_acquire);
+            if (key == dataToken)
+            {
+                return &slot.stats;
+            }
+            if (key == EmptySlot)
+            {
+                break;
+            }
+        }
+        if (!create)
+        {
+            return nullptr;
+        }
+        auto stats = Insert(dataToken, start);
+        if (stats == nullptr)
+        {
+            _overflows.fetch_add(1, std::memory_order_relaxed);
+        }
+        return stats;
+    }
+
+    // Calls that could not record because every slot was in use.
+    inline int64_t Overflows() const
+    {
+        return _overflows.load(std::memory_order_relaxed);
+    }
+
+    // Retired slots keep probe chains intact and are reused by later tokens.
+    inline void Remove(int64_t dataToken)
+    {
+        auto start = Hash(dataToken);
+        for (size_t probe = 0; probe < SlotCount; ++probe)
+        {
+            auto& slot = _slots[(start + probe) % SlotCount];
+            auto key = slot.token.load(std::memory_order_acquire);
+            if (key == EmptySlot)
+            {
+                return;
+            }
+            if (key == dataToken)
+            {
+                slot.stats.Reset();
+                slot.token.store(RetiredSlot, std::memory_order_release);
+                return;
+            }
+        }
+    }
+
+private:
+    inline SidebandTokenStats* Insert(int64_t dataToken, size_t start)
+    {
+        for (size_t probe = 0; probe < SlotCount; ++probe)
+        {
+            auto& slot = _slots[(start + probe) % SlotCount];
+            auto key = slot.token.load(std::memory_order_acquire);
+            if (key == EmptySlot || key == RetiredSlot)
+            {
+                if (slot.token.compare_exchange_strong(key, dataToken, std::memory_order_acq_rel))
+                {
+                    return &slot.stats;
+                }
+            }
+            if (key == dataToken)
+            {
+                return &slot.stats;
+            }
+        }
+        return nullptr;
+    }
+
+private:
+    static const size_t SlotCount = 256;
+    static const int64_t EmptySlot = 0;
+    static const int64_t RetiredSlot = -1;
+
+    struct Slot
+    {
+        std::atomic<int64_t> token { EmptySlot };
+        SidebandTokenStats stats;
+    };
+
+    inline static size_t Hash(int64_t dataToken)
+    {
+        auto value = (uint64_t)dataToken;
+        value ^= value >> 33;
+        value *= 0xff51afd7ed558ccdULL;
+        value ^= value >> 33;
+        return (size_t)(value % SlotCount);
+    }
+
+private:
+    std::array<Slot, SlotCount> _slots;
+    std::atomic<int64_t> _overflows { 0 };
+};
+
+//---------------------------------------------------------------------
+// Returns -1 for tokens without stats, including tokens that were opened
+// while the registry was full, see SidebandData_GetStatsOverflows.
+//---------------------------------------------------------------------
+inline int32_t SidebandData_GetStats(int64_t sidebandToken, SidebandStats* stats)
+{
+    auto tokenStats = SidebandStatsRegistry::Instance().Find(sidebandToken, false);
+    if (tokenStats == nullptr)
+    {
+        *stats = SidebandStats {};
+        return -1;
+    }
+    tokenStats->CopyTo(stats);
+    return 0;
+}
+
+//---------------------------------------------------------------------
+//---------------------------------------------------------------------
+inline int32_t SidebandData_ResetStats(int64_t sidebandToken)
+{
+    auto tokenStats = SidebandStatsRegistry::Instance().Find(sidebandToken, false);
+    if (tokenStats == nullptr)
+    {
+        return -1;
+    }
+    tokenStats->Reset();
+    return 0;
+}
+
+//---------------------------------------------------------------------
+// Number of reads and writes that went unrecorded because more tokens
+// were open than the registry has slots.  Nonzero means tokens are not
+// being closed with CloseClientSidebandData.
+//---------------------------------------------------------------------
+inline int64_t SidebandData_GetStatsOverflows()
+{
+    return SidebandStatsRegistry::Instance().Overflows();
+}
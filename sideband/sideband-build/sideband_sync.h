@@ -0,0 +1,125 @@
+#pragma once
+
+//---------------------------------------------------------------------
+//---------------------------------------------------------------------
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include "sideband_fifo.h"
+
+//---------------------------------------------------------------------
+// One trigger timestamp of a nisync
+// MonikerReadMultipleTriggerTimeStampResponse.  The timestamps bytes
+// hold timestamps_read of these back to back, in the units
+// niSync_ReadMultipleTriggerTimeStamp returns: seconds and nanoseconds
+// of the NI-Sync time base, and fractional nanoseconds in 1/65536 ns.
+// Assumes a little endian host.
+//---------------------------------------------------------------------
+struct SidebandTriggerTimestamp
+{
+    uint32_t seconds;
+    uint32_t nanoseconds;
+    uint32_t fractionalNanoseconds;
+    int32_t detectedEdge;
+
+    // Nanoseconds from t, including the fractional part.
+    inline double NanosecondsSince(const SidebandTriggerTimestamp& t) const
+    {
+        auto whole = ((int64_t)seconds - (int64_t)t.seconds) * 1000000000 + ((int64_t)nanoseconds - (int64_t)t.nanoseconds);
+        return (double)whole + ((double)fractionalNanoseconds - (double)t.fractionalNanoseconds) / 65536.0;
+    }
+};
+
+static_assert(sizeof(SidebandTriggerTimestamp) == 16, "SidebandTriggerTimestamp must stay 16 bytes, it is the wire layout");
+
+//---------------------------------------------------------------------
+// Timestamps of a timestamps field, without copying them.
+//---------------------------------------------------------------------
+typedef SidebandFifoView<SidebandTriggerTimestamp> SidebandTriggerTimestamps;
+
+//---------------------------------------------------------------------
+// Fills the timestamps field from the arrays
+// niSync_ReadMultipleTriggerTimeStamp returns.
+//---------------------------------------------------------------------
+template <class Fraction>
+inline void SetSidebandTriggerTimestamps(std::string* timestamps, const uint32_t* seconds, const uint32_t* nanoseconds, const Fraction* fractionalNanoseconds, const int32_t* detectedEdge, size_t count)
+{
+    timestamps->resize(count * sizeof(SidebandTriggerTimestamp));
+    auto records = reinterpret_cast<SidebandTriggerTimestamp*>(&(*timestamps)[0]);
+    for (size_t x = 0; x < count; ++x)
+    {
+        records[x].seconds = seconds[x];
+        records[x].nanoseconds = nanoseconds[x];
+        records[x].fractionalNanoseconds = (uint32_t)fractionalNanoseconds[x];
+        records[x].detectedEdge = detectedEdge[x];
+    }
+}
+
+//---------------------------------------------------------------------
+// Joins a trigger timestamp moniker with a sample stream read in the same
+// sideband frames, for example a DAQ read moniker.  The sample stream is
+// described by the NI-Sync time of its sample 0 and its sample rate.
+//
+// Every frame, AddTimestamps queues the timestamps of the frame and
+// Align is called with the block of samples of the same frame.  Each
+// queued timestamp up to the end of the block is handed to
+// callback(const SidebandTriggerTimestamp&, int64_t sampleIndex,
+// double sampleOffset), where sampleIndex is the sample at or before the
+// timestamp and sampleOffset the fraction of a sample period after it.
+// Timestamps past the block stay queued for later blocks, so it does not
+// matter which of the two monikers delivers first.
+//---------------------------------------------------------------------
+class SidebandTimestampAligner
+{
+public:
+    SidebandTimestampAligner(const SidebandTriggerTimestamp& sampleZero, double sampleRate)
+        : _sampleZero(sampleZero), _samplesPerNanosecond(sampleRate / 1e9)
+    {
+    }
+
+    inline void AddTimestamps(const std::string& timestamps)
+    {
+        for (const auto& timestamp : SidebandTriggerTimestamps(timestamps))
+        {
+            _pending.push_back(timestamp);
+        }
+    }
+
+    // Position of timestamp in samples from sample 0.
+    inline double SamplePosition(const SidebandTriggerTimestamp& timestamp) const
+    {
+        return timestamp.NanosecondsSince(_sampleZero) * _samplesPerNanosecond;
+    }
+
+    // Hands out the queued timestamps that fall before
+    // firstSample + sampleCount, including any before firstSample that
+    // were queued too late for their block.  Returns how many.
+    template <class Callback>
+    inline size_t Align(int64_t firstSample, int64_t sampleCount, Callback callback)
+    {
+        auto end = (double)(firstSample + sampleCount);
+        size_t aligned = 0;
+        while (!_pending.empty())
+        {
+            auto position = SamplePosition(_pending.front());
+            if (position >= end)
+            {
+                break;
+            }
+            auto sampleIndex = (int64_t)std::floor(position);
+            callback(_pending.front(), sampleIndex, position - (double)sampleIndex);
+            _pending.pop_front();
+            ++aligned;
+        }
+        return aligned;
+    }
+
+    inline size_t Pending() const { return _pending.size(); }
+
+private:
+    SidebandTriggerTimestamp _sampleZero;
+    double _samplesPerNanosecond;
+    std::deque<SidebandTriggerTimestamp> _pending;
+};
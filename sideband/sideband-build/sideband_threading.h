@@ -0,0 +1,180 @@
+#pragma once
+
+//---------------------------------------------------------------------
+//---------------------------------------------------------------------
+#ifdef _WIN32
+    #ifndef WIN32_LEAN_AND_MEAN
+        #define WIN32_LEAN_AND_MEAN
+    #endif
+    #include <windows.h>
+#else
+    #include <pthread.h>
+    #include <sched.h>
+    #include <sys/mman.h>
+    #include <sys/utsname.h>
+#endif
+
+//---------------------------------------------------------------------
+//---------------------------------------------------------------------
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <thread>
+
+//---------------------------------------------------------------------
+// Scheduling for threads that move sideband data.  cpu < 0 leaves the
+// affinity alone, priority 0 leaves the scheduling class alone and 1-99
+// selects SCHED_FIFO at that priority.
+//---------------------------------------------------------------------
+struct SidebandThreadPolicy
+{
+    int32_t cpu;
+    int32_t priority;
+    bool lockMemory;
+};
+
+//---------------------------------------------------------------------
+// All functions return 0 on success and -1 on failure, with errno (or
+// GetLastError on Windows) describing the failure.  Raising priority or
+// locking memory usually needs CAP_SYS_NICE / CAP_IPC_LOCK or matching
+// rlimits.
+//---------------------------------------------------------------------
+inline int32_t SidebandThread_SetAffinity(std::thread::native_handle_type thread, int32_t cpu)
+{
+    if (cpu < 0)
+    {
+        return 0;
+    }
+#ifdef _WIN32
+    if (cpu >= (int32_t)(sizeof(DWORD_PTR) * 8))
+    {
+        SetLastError(ERROR_INVALID_PARAMETER);
+        return -1;
+    }
+    return SetThreadAffinityMask((HANDLE)thread, (DWORD_PTR)1 << cpu) != 0 ? 0 : -1;
+#else
+    if (cpu >= CPU_SETSIZE)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(cpu, &cpus);
+    // pthread calls return the error instead of setting errno.
+    auto result = pthread_setaffinity_np(thread, sizeof(cpus), &cpus);
+    if (result != 0)
+    {
+        errno = result;
+        return -1;
+    }
+    return 0;
+#endif
+}
+
+//---------------------------------------------------------------------
+//---------------------------------------------------------------------
+inline int32_t SidebandThread_SetPriority(std::thread::native_handle_type thread, int32_t priority)
+{
+#ifdef _WIN32
+    if (priority <= 0)
+    {
+        return 0;
+    }
+    return SetThreadPriority((HANDLE)thread, priority >= 50 ? THREAD_PRIORITY_TIME_CRITICAL : THREAD_PRIORITY_HIGHEST) ? 0 : -1;
+#else
+    sched_param parameters;
+    std::memset(&parameters, 0, sizeof(parameters));
+    if (priority <= 0)
+    {
+        return 0;
+    }
+    auto minimum = sched_get_priority_min(SCHED_FIFO);
+    auto maximum = sched_get_priority_max(SCHED_FIFO);
+    parameters.sched_priority = priority < minimum ? minimum : (priority > maximum ? maximum : priority);
+    auto result = pthread_setschedparam(thread, SCHED_FIFO, &parameters);
+    if (result != 0)
+    {
+        errno = result;
+        return -1;
+    }
+    return 0;
+#endif
+}
+
+//---------------------------------------------------------------------
+// Locks current and future pages so page faults cannot stall a loop.
+//---------------------------------------------------------------------
+inline int32_t SidebandThread_LockMemory()
+{
+#ifdef _WIN32
+    SetLastError(ERROR_NOT_SUPPORTED);
+    return -1;
+#else
+    return mlockall(MCL_CURRENT | MCL_FUTURE) == 0 ? 0 : -1;
+#endif
+}
+
+//---------------------------------------------------------------------
+// Returns 1 on a PREEMPT_RT kernel, 0 otherwise.
+//---------------------------------------------------------------------
+inline int32_t SidebandThread_IsRealtimeKernel()
+{
+#ifdef _WIN32
+    return 0;
+#else
+    std::ifstream realtime("/sys/kernel/realtime");
+    int value = 0;
+    if (realtime >> value && value == 1)
+    {
+        return 1;
+    }
+    utsname name;
+    if (uname(&name) == 0 && (std::strstr(name.version, "PREEMPT_RT") != nullptr || std::strstr(name.version, "PREEMPT RT") != nullptr))
+    {
+        return 1;
+    }
+    return 0;
+#endif
+}
+
+//---------------------------------------------------------------------
+// Applies every part of the policy, failures do not stop the remaining
+// parts from being applied.
+//---------------------------------------------------------------------
+inline int32_t SidebandThread_ApplyPolicy(std::thread::native_handle_type thread, const SidebandThreadPolicy& policy)
+{
+    int32_t result = 0;
+    if (SidebandThread_SetAffinity(thread, policy.cpu) != 0)
+    {
+        result = -1;
+    }
+    if (SidebandThread_SetPriority(thread, policy.priority) != 0)
+    {
+        result = -1;
+    }
+    if (policy.lockMemory && SidebandThread_LockMemory() != 0)
+    {
+        result = -1;
+    }
+    return result;
+}
+
+//---------------------------------------------------------------------
+//---------------------------------------------------------------------
+inline std::thread::native_handle_type SidebandThread_Current()
+{
+#ifdef _WIN32
+    return (std::thread::native_handle_type)GetCurrentThread();
+#else
+    return pthread_self();
+#endif
+}
+
+//---------------------------------------------------------------------
+//---------------------------------------------------------------------
+inline int32_t SidebandThread_ApplyPolicyToCurrentThread(const SidebandThreadPolicy& policy)
+{
+    return SidebandThread_ApplyPolicy(SidebandThread_Current(), policy);
+}
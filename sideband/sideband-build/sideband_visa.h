@@ -0,0 +1,156 @@
+#pragma once
+
+//---------------------------------------------------------------------
+//---------------------------------------------------------------------
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include "sideband_fifo.h"
+
+//---------------------------------------------------------------------
+// Block move monikers (visa BeginMoveInXX / BeginMoveOutXX) carry the
+// moved elements as raw little endian bytes, like the FIFO monikers.
+// Each read or write moves one block; with increment_offset the next
+// block continues where the last one ended, so a register space or
+// instrument memory dump is a stream of consecutive blocks.
+//
+// The server fills the sideband write buffer with viMoveIn directly.
+// The status of the move is only known after the data is in place, so
+// the frame puts the buffer field first and ends with a fixed size
+// trailer: status as a ten byte varint and offset as fixed64.  Fields
+// out of order and padded varints are valid protobuf encoding, the
+// frame parses to the same MonikerMoveInXXResponse.
+//---------------------------------------------------------------------
+class SidebandBlockMoveFrame
+{
+public:
+    static const int64_t TrailerSize = 1 + 10 + 1 + 8;
+
+    // Size of the SidebandReadResponse frame for a block of byteCount.
+    inline static int64_t FrameSize(const std::string& typeUrl, int64_t byteCount)
+    {
+        auto any = AnySize(typeUrl, InnerSize(byteCount));
+        auto values = 1 + SidebandFifoFrame::VarintSize(any) + any;
+        return 1 + SidebandFifoFrame::VarintSize(values) + values;
+    }
+
+    // Writes everything up to the block, returns where the block goes.
+    inline static uint8_t* EncodeHeader(uint8_t* buffer, const std::string& typeUrl, int64_t byteCount)
+    {
+        auto inner = InnerSize(byteCount);
+        auto any = AnySize(typeUrl, inner);
+        auto values = 1 + SidebandFifoFrame::VarintSize(any) + any;
+        auto out = buffer;
+        // SidebandReadResponse.values
+        *out++ = 0x12;
+        out = SidebandFifoFrame::WriteVarint(out, values);
+        // MonikerValues.values
+        *out++ = 0x0A;
+        out = SidebandFifoFrame::WriteVarint(out, any);
+        // Any.type_url
+        *out++ = 0x0A;
+        out = SidebandFifoFrame::WriteVarint(out, typeUrl.size());
+        std::memcpy(out, typeUrl.data(), typeUrl.size());
+        out += typeUrl.size();
+        // Any.value
+        *out++ = 0x12;
+        out = SidebandFifoFrame::WriteVarint(out, inner);
+        // buffer
+        *out++ = 0x12;
+        return SidebandFifoFrame::WriteVarint(out, byteCount);
+    }
+
+    // Writes status and offset after the block, which ends at out.
+    inline static void EncodeTrailer(uint8_t* out, int32_t status, uint64_t offset)
+    {
+        // status, sign extended and padded to ten bytes
+        *out++ = 0x08;
+        auto value = (uint64_t)(int64_t)status;
+        for (int x = 0; x < 9; ++x)
+        {
+            *out++ = (uint8_t)(value | 0x80);
+            value >>= 7;
+        }
+        *out++ = (uint8_t)(value & 0x01);
+        // offset
+        *out++ = 0x19;
+        for (int x = 0; x < 8; ++x)
+        {
+            *out++ = (uint8_t)(offset >> (8 * x));
+        }
+    }
+
+private:
+    inline static int64_t InnerSize(int64_t byteCount)
+    {
+        return 1 + SidebandFifoFrame::VarintSize(byteCount) + byteCount + TrailerSize;
+    }
+
+    inline static int64_t AnySize(const std::string& typeUrl, int64_t inner)
+    {
+        return 1 + SidebandFifoFrame::VarintSize(typeUrl.size()) + (int64_t)typeUrl.size() + 1 + SidebandFifoFrame::VarintSize(inner) + inner;
+    }
+};
+
+//---------------------------------------------------------------------
+// Sends one block for the read moniker of a stream that has no other
+// read monikers.  fill(uint8_t* block) moves byteCount bytes into block,
+// typically with viMoveInXX, and returns the VISA status.  On transports
+// with direct writes and no codec the block is filled in the sideband
+// buffer when FrameSize fits the stream's registered buffer size;
+// otherwise it is filled in a pooled buffer.  offset is reported with the
+// block.  Returns the frame size or -1.  A frame larger than the buffer
+// of a direct transport fails before fill is called, so nothing is moved
+// out of the instrument.
+//---------------------------------------------------------------------
+template <class Fill>
+inline int64_t WriteSidebandBlockMove(int64_t dataToken, const std::string& typeUrl, int64_t byteCount, uint64_t offset, Fill fill)
+{
+    auto frameSize = SidebandBlockMoveFrame::FrameSize(typeUrl, byteCount);
+    auto stats = SidebandStatsRegistry::Instance().Find(dataToken, true);
+    auto codec = SidebandCodecTable::Instance().Get(dataToken);
+    auto path = ChooseSidebandWritePath(dataToken, frameSize);
+    if (codec.codec == SidebandCodec::NONE && path == SidebandWritePath::TOO_LARGE)
+    {
+        RecordSidebandError(stats, -1);
+        return -1;
+    }
+    bool direct = codec.codec == SidebandCodec::NONE && path == SidebandWritePath::DIRECT;
+    auto start = std::chrono::steady_clock::now();
+    int32_t result = 0;
+    int64_t written = frameSize;
+    if (direct)
+    {
+        uint8_t* buffer = nullptr;
+        result = BeginSidebandDirectWrite(dataToken, frameSize, &buffer);
+        RecordSidebandError(stats, result);
+        if (result != 0)
+        {
+            return -1;
+        }
+        auto block = SidebandBlockMoveFrame::EncodeHeader(buffer, typeUrl, byteCount);
+        SidebandBlockMoveFrame::EncodeTrailer(block + byteCount, fill(block), offset);
+        result = SidebandData_FinishDirectWrite(dataToken, frameSize);
+    }
+    else
+    {
+        auto frame = SidebandBufferPool::Instance().Acquire(frameSize);
+        auto block = SidebandBlockMoveFrame::EncodeHeader(frame.Data(), typeUrl, byteCount);
+        SidebandBlockMoveFrame::EncodeTrailer(block + byteCount, fill(block), offset);
+        if (codec.codec != SidebandCodec::NONE)
+        {
+            auto encoded = EncodeSidebandBlock(codec, frame.Data(), frameSize, &written, stats);
+            result = SendSidebandFrame(dataToken, encoded.Data(), written, &direct);
+        }
+        else
+        {
+            result = SidebandData_WriteLengthPrefixed(dataToken, frame.Data(), frameSize);
+        }
+    }
+    RecordSidebandError(stats, result);
+    if (stats != nullptr)
+    {
+        stats->RecordWrite(written, direct, SidebandElapsedNanoseconds(start));
+    }
+    return result == 0 ? frameSize : -1;
+}
@@ -0,0 +1,140 @@
+#pragma once
+
+//---------------------------------------------------------------------
+//---------------------------------------------------------------------
+#include <complex>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+//---------------------------------------------------------------------
+// Client view of a binary waveform moniker response (for example
+// niscope MonikerFetchBinary16Response): the raw samples of every record
+// back to back in one bytes field, plus one info message per record
+// carrying actual_samples, gain and offset.  Records are laid out at a
+// fixed stride of the requested sample count, actual_samples of each
+// record are valid.  Nothing is copied until Scale is called.  Assumes a
+// little endian host.
+//---------------------------------------------------------------------
+template <class T, class Info>
+class SidebandWaveformRecords
+{
+public:
+    template <class InfoList>
+    SidebandWaveformRecords(const std::string& waveform, const InfoList& info)
+        : _samples(reinterpret_cast<const T*>(waveform.data())), _sampleCount(waveform.size() / sizeof(T))
+    {
+        for (const auto& record : info)
+        {
+            _info.push_back(&record);
+        }
+        _stride = _info.empty() ? 0 : _sampleCount / _info.size();
+    }
+
+    inline size_t RecordCount() const
+    {
+        return _info.size();
+    }
+
+    inline const Info& RecordInfo(size_t index) const
+    {
+        return *_info[index];
+    }
+
+    inline const T* RecordSamples(size_t index) const
+    {
+        return _samples + index * _stride;
+    }
+
+    inline size_t RecordSize(size_t index) const
+    {
+        auto actual = (size_t)_info[index]->actual_samples();
+        return actual < _stride ? actual : _stride;
+    }
+
+    // Converts one record to volts, out must hold RecordSize(index) values.
+    inline void Scale(size_t index, double* out) const
+    {
+        auto samples = RecordSamples(index);
+        auto count = RecordSize(index);
+        double gain = _info[index]->gain();
+        double offset = _info[index]->offset();
+        for (size_t x = 0; x < count; ++x)
+        {
+            out[x] = samples[x] * gain + offset;
+        }
+    }
+
+    inline std::vector<double> Scale(size_t index) const
+    {
+        std::vector<double> volts(RecordSize(index));
+        Scale(index, volts.data());
+        return volts;
+    }
+
+private:
+    const T* _samples;
+    size_t _sampleCount;
+    size_t _stride;
+    std::vector<const Info*> _info;
+};
+
+//---------------------------------------------------------------------
+// Converts interleaved little endian int16 I/Q pairs (for example nirfsa
+// MonikerFetchIQSingleRecordComplexI16Response data) to complex values
+// scaled by the record gain and offset.  out must hold data.size() / 4
+// values.  Returns the number of samples converted.
+//---------------------------------------------------------------------
+inline size_t ScaleSidebandIQ(const std::string& data, double gain, double offset, std::complex<float>* out)
+{
+    auto samples = reinterpret_cast<const int16_t*>(data.data());
+    auto count = data.size() / (2 * sizeof(int16_t));
+    auto scale = (float)gain;
+    auto shift = (float)offset;
+    for (size_t x = 0; x < count; ++x)
+    {
+        out[x] = std::complex<float>(samples[2 * x] * scale + shift, samples[2 * x + 1] * scale + shift);
+    }
+    return count;
+}
+
+//---------------------------------------------------------------------
+// Client view of a packed double waveform with uniform timing (for
+// example nidmm MonikerFetchWaveformResponse): the points as little
+// endian doubles in one bytes field, the index of the first point since
+// the moniker began and the interval between points in seconds.
+//---------------------------------------------------------------------
+class SidebandTimedPoints
+{
+public:
+    SidebandTimedPoints(const std::string& points, int64_t firstPoint, double sampleInterval)
+        : _points(reinterpret_cast<const double*>(points.data())), _count(points.size() / sizeof(double)), _firstPoint(firstPoint), _sampleInterval(sampleInterval)
+    {
+    }
+
+    inline const double* data() const { return _points; }
+    inline size_t size() const { return _count; }
+    inline const double* begin() const { return _points; }
+    inline const double* end() const { return _points + _count; }
+    inline const double& operator[](size_t index) const { return _points[index]; }
+
+    // Seconds from the first point of the acquisition to point index.
+    inline double Time(size_t index) const
+    {
+        return (double)(_firstPoint + (int64_t)index) * _sampleInterval;
+    }
+
+    // Index of the point after the last one, the first_point of the next
+    // response unless points were lost.
+    inline int64_t NextPoint() const
+    {
+        return _firstPoint + (int64_t)_count;
+    }
+
+private:
+    const double* _points;
+    size_t _count;
+    int64_t _firstPoint;
+    double _sampleInterval;
+};
@@ -0,0 +1,356 @@
+#pragma once
+
+//---------------------------------------------------------------------
+//---------------------------------------------------------------------
+#include <cstdint>
+#include <cstring>
+#include "sideband_grpc.h"
+
+//---------------------------------------------------------------------
+// One frame of an XNET frame buffer in the native nxFrameVar_t layout:
+//
+//   u64 Timestamp, u32 Identifier, u8 Type, u8 Flags, u8 Info,
+//   u8 PayloadLength, payload padded to 8 bytes (at least 8)
+//
+// Large payloads (J1939, Ethernet) keep their upper length bits in Info,
+// as nxFrameGetPayloadLength does.  The header fields are copied out,
+// the payload points into the buffer that holds the frames.
+//---------------------------------------------------------------------
+struct SidebandXnetFrame
+{
+    static const int64_t HeaderSize = 16;
+    static const uint8_t PayloadLengthHighMask = 0x1F;
+
+    uint64_t timestamp;
+    uint32_t identifier;
+    uint8_t type;
+    uint8_t flags;
+    uint8_t info;
+    uint16_t payloadLength;
+    const uint8_t* payload;
+
+    // Bytes the frame occupies in the buffer, nxFrameSize.
+    inline static int64_t FrameSize(uint16_t payloadLength)
+    {
+        return HeaderSize + (payloadLength <= 8 ? 8 : ((payloadLength + 7) & ~7));
+    }
+};
+
+//---------------------------------------------------------------------
+// Walks the variable length frames of a buffer without copying it.  A
+// truncated last frame ends the walk.
+//---------------------------------------------------------------------
+class SidebandXnetFrameIterator
+{
+public:
+    SidebandXnetFrameIterator(const uint8_t* position, const uint8_t* end)
+        : _position(position), _end(end)
+    {
+        Load();
+    }
+
+    inline const SidebandXnetFrame& operator*() const { return _frame; }
+    inline const SidebandXnetFrame* operator->() const { return &_frame; }
+
+    inline SidebandXnetFrameIterator& operator++()
+    {
+        _position += SidebandXnetFrame::FrameSize(_frame.payloadLength);
+        Load();
+        return *this;
+    }
+
+    inline bool operator==(const SidebandXnetFrameIterator& other) const { return _position == other._position; }
+    inline bool operator!=(const SidebandXnetFrameIterator& other) const { return _position != other._position; }
+
+private:
+    inline void Load()
+    {
+        if (_end - _position < SidebandXnetFrame::HeaderSize)
+        {
+            _position = _end;
+            return;
+        }
+        std::memcpy(&_frame.timestamp, _position, sizeof(_frame.timestamp));
+        std::memcpy(&_frame.identifier, _position + 8, sizeof(_frame.identifier));
+        _frame.type = _position[12];
+        _frame.flags = _position[13];
+        _frame.info = _position[14];
+        _frame.payloadLength = (uint16_t)(_position[15] | ((_frame.info & SidebandXnetFrame::PayloadLengthHighMask) << 8));
+        _frame.payload = _position + SidebandXnetFrame::HeaderSize;
+        if (_end - _position < SidebandXnetFrame::FrameSize(_frame.payloadLength))
+        {
+            _position = _end;
+        }
+    }
+
+private:
+    const uint8_t* _position;
+    const uint8_t* _end;
+    SidebandXnetFrame _frame;
+};
+
+//---------------------------------------------------------------------
+//---------------------------------------------------------------------
+class SidebandXnetFrames
+{
+public:
+    SidebandXnetFrames(const uint8_t* buffer, int64_t byteCount)
+        : _buffer(buffer), _byteCount(byteCount)
+    {
+    }
+
+    inline SidebandXnetFrameIterator begin() const { return SidebandXnetFrameIterator(_buffer, _buffer + _byteCount); }
+    inline SidebandXnetFrameIterator end() const { return SidebandXnetFrameIterator(_buffer + _byteCount, _buffer + _byteCount); }
+    inline const uint8_t* Data() const { return _buffer; }
+    inline int64_t ByteCount() const { return _byteCount; }
+
+private:
+    const uint8_t* _buffer;
+    int64_t _byteCount;
+};
+
+//---------------------------------------------------------------------
+// Minimal protobuf wire reader, enough to find a bytes field inside a
+// sideband frame without parsing it into messages.
+//---------------------------------------------------------------------
+class SidebandWireReader
+{
+public:
+    SidebandWireReader(const uint8_t* data, int64_t size)
+        : _position(data), _end(data + size)
+    {
+    }
+
+    // Moves to the next field, false at the end or on malformed input.
+    inline bool Next(uint32_t* field, uint32_t* wireType)
+    {
+        uint64_t key = 0;
+        if (_position >= _end || !ReadVarint(&key))
+        {
+            return false;
+        }
+        *field = (uint32_t)(key >> 3);
+        *wireType = (uint32_t)(key & 7);
+        return true;
+    }
+
+    inline bool ReadVarint(uint64_t* value)
+    {
+        *value = 0;
+        for (int shift = 0; shift < 64 && _position < _end; shift += 7)
+        {
+            auto byte = *_position++;
+            *value |= (uint64_t)(byte & 0x7F) << shift;
+            if ((byte & 0x80) == 0)
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    inline bool ReadBytes(const uint8_t** data, int64_t* size)
+    {
+        uint64_t length = 0;
+        if (!ReadVarint(&length) || length > (uint64_t)(_end - _position))
+        {
+            return false;
+        }
+        *data = _position;
+        *size = (int64_t)length;
+        _position += length;
+        return true;
+    }
+
+    inline bool Skip(uint32_t wireType)
+    {
+        uint64_t value = 0;
+        const uint8_t* data = nullptr;
+        int64_t size = 0;
+        switch (wireType)
+        {
+        case 0:
+            return ReadVarint(&value);
+        case 1:
+            return Advance(8);
+        case 2:
+            return ReadBytes(&data, &size);
+        case 5:
+            return Advance(4);
+        default:
+            return false;
+        }
+    }
+
+    // Finds the index-th occurrence of a length delimited field.
+    inline static bool Find(const uint8_t* data, int64_t size, uint32_t field, int32_t index, const uint8_t** out, int64_t* outSize)
+    {
+        SidebandWireReader reader(data, size);
+        uint32_t current = 0;
+        uint32_t wireType = 0;
+        while (reader.Next(&current, &wireType))
+        {
+            if (current == field && wireType == 2)
+            {
+                if (!reader.ReadBytes(out, outSize))
+                {
+                    return false;
+                }
+                if (index-- == 0)
+                {
+                    return true;
+                }
+            }
+            else if (!reader.Skip(wireType))
+            {
+                return false;
+            }
+        }
+        return false;
+    }
+
+private:
+    inline bool Advance(int64_t byteCount)
+    {
+        if (_end - _position < byteCount)
+        {
+            return false;
+        }
+        _position += byteCount;
+        return true;
+    }
+
+private:
+    const uint8_t* _position;
+    const uint8_t* _end;
+};
+
+//---------------------------------------------------------------------
+// Locates the frames of the MonikerReadFrameResponse for read moniker
+// monikerIndex inside a decoded SidebandReadResponse.  A response that
+// carries no frames yields an empty SidebandXnetFrames.
+//---------------------------------------------------------------------
+inline bool FindSidebandXnetFrames(const uint8_t* response, int64_t responseSize, int32_t monikerIndex, SidebandXnetFrames* frames, int32_t* status)
+{
+    const uint8_t* values = nullptr;
+    const uint8_t* any = nullptr;
+    const uint8_t* value = nullptr;
+    int64_t valuesSize = 0;
+    int64_t anySize = 0;
+    int64_t valueSize = 0;
+    // SidebandReadResponse.values, MonikerValues.values[monikerIndex], Any.value
+    if (!SidebandWireReader::Find(response, responseSize, 2, 0, &values, &valuesSize)
+        || !SidebandWireReader::Find(values, valuesSize, 1, monikerIndex, &any, &anySize))
+    {
+        return false;
+    }
+    *status = 0;
+    *frames = SidebandXnetFrames(nullptr, 0);
+    if (!SidebandWireReader::Find(any, anySize, 2, 0, &value, &valueSize))
+    {
+        return true;
+    }
+    SidebandWireReader reader(value, valueSize);
+    uint32_t field = 0;
+    uint32_t wireType = 0;
+    while (reader.Next(&field, &wireType))
+    {
+        if (field == 1 && wireType == 0)
+        {
+            uint64_t raw = 0;
+            if (!reader.ReadVarint(&raw))
+            {
+                return false;
+            }
+            *status = (int32_t)raw;
+        }
+        else if (field == 2 && wireType == 2)
+        {
+            const uint8_t* buffer = nullptr;
+            int64_t byteCount = 0;
+            if (!reader.ReadBytes(&buffer, &byteCount))
+            {
+                return false;
+            }
+            *frames = SidebandXnetFrames(buffer, byteCount);
+        }
+        else if (!reader.Skip(wireType))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+//---------------------------------------------------------------------
+// Reads one sideband frame of a BeginReadFrame stream and hands the XNET
+// frames to callback(const SidebandXnetFrames&, int32_t status) while
+// they are still in the sideband buffer.  On transports with direct
+// reads and no codec nothing is copied.  The frames are only valid
+// during the callback.  Returns false on a read or framing error and
+// on the cancel frame that ends a stream.
+//---------------------------------------------------------------------
+template <class Callback>
+inline bool ReadSidebandXnetFrames(int64_t dataToken, int32_t monikerIndex, Callback callback)
+{
+    auto stats = SidebandStatsRegistry::Instance().Find(dataToken, true);
+    auto codec = SidebandCodecTable::Instance().Get(dataToken);
+    bool direct = SidebandData_SupportsDirectReadWrite(dataToken) == 1;
+    auto start = std::chrono::steady_clock::now();
+    const uint8_t* buffer = nullptr;
+    int64_t bufferSize = 0;
+    SidebandBufferPool::Lease copy;
+    int32_t result = 0;
+    if (direct)
+    {
+        result = SidebandData_BeginDirectReadLengthPrefixed(dataToken, &bufferSize, &buffer);
+    }
+    else
+    {
+        result = SidebandData_ReadLengthPrefix(dataToken, &bufferSize);
+        // A corrupt length prefix must not turn into a huge allocation.
+        if (result == 0 && (bufferSize < 0 || bufferSize > SidebandFrameLimits::Instance().ReadLimit(dataToken)))
+        {
+            result = -1;
+        }
+        int64_t bytesRead = 0;
+        if (result == 0)
+        {
+            copy = SidebandBufferPool::Instance().Acquire(bufferSize);
+            result = SidebandData_ReadFromLengthPrefixed(dataToken, copy.Data(), bufferSize, &bytesRead);
+            buffer = copy.Data();
+        }
+    }
+    RecordSidebandError(stats, result);
+    if (stats != nullptr)
+    {
+        stats->RecordRead(bufferSize, direct, SidebandElapsedNanoseconds(start));
+    }
+    bool success = result == 0 && buffer != nullptr;
+    if (success)
+    {
+        if (auto recorder = SidebandRecorderTable::Instance().Find(dataToken))
+        {
+            recorder->Append(buffer, bufferSize);
+        }
+        SidebandBufferPool::Lease decoded;
+        int64_t decodedSize = bufferSize;
+        if (codec.codec != SidebandCodec::NONE)
+        {
+            success = DecodeSidebandBlock(buffer, bufferSize, &decoded, &decodedSize, stats);
+            buffer = decoded.Data();
+        }
+        SidebandXnetFrames frames(nullptr, 0);
+        int32_t status = 0;
+        success = success && FindSidebandXnetFrames(buffer, decodedSize, monikerIndex, &frames, &status);
+        if (success)
+        {
+            callback(frames, status);
+        }
+    }
+    if (direct)
+    {
+        SidebandData_FinishDirectRead(dataToken);
+    }
+    return success;
+}